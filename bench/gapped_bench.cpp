@@ -0,0 +1,128 @@
+// Microbenchmark for the gapped extension kernels
+// Aligns a sequence against a copy with substitutions and short indels
+// from many anchors, with the scalar, SSE4.2 and AVX2 kernels. Checks that
+// every kernel returns exactly the scalar result, and that each CIGAR
+// string spans the reported ranges and rescores to the reported score.
+//
+// Usage: gapped_bench [length] [identity_percent] [indel_percent] [anchors]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../gapped.h"
+
+static bool sameResult(const GappedResult& a, const GappedResult& b) {
+    return a.db_start == b.db_start && a.db_end == b.db_end &&
+           a.q_start == b.q_start && a.q_end == b.q_end &&
+           a.score == b.score && a.identity == b.identity && a.cigar == b.cigar;
+}
+
+// Rescore a CIGAR string and check that it covers the reported ranges
+static bool consistent(const GappedResult& r, const std::string& db, const std::string& q,
+                       const GappedOptions& options) {
+    int db_pos = r.db_start, q_pos = r.q_start, score = 0, count = 0;
+    for (char c : r.cigar) {
+        if (c >= '0' && c <= '9') {
+            count = count * 10 + (c - '0');
+            continue;
+        }
+        if (c == 'M') {
+            for (int n = 0; n < count; ++n) {
+                score += db[db_pos++] == q[q_pos++] ? 2 : -1;
+            }
+        } else {
+            score -= options.gap_open + count * options.gap_extend;
+            (c == 'I' ? q_pos : db_pos) += count;
+        }
+        count = 0;
+    }
+    return score == r.score && db_pos == r.db_end + 1 && q_pos == r.q_end + 1;
+}
+
+int main(int argc, char* argv[]) {
+    int length = argc > 1 ? std::atoi(argv[1]) : 5000;
+    int identity = argc > 2 ? std::atoi(argv[2]) : 95;
+    int indels = argc > 3 ? std::atoi(argv[3]) : 1;
+    int num_anchors = argc > 4 ? std::atoi(argv[4]) : 200;
+
+    // Database sequence and a copy with substitutions, insertions and
+    // deletions of 1-4 bases as the query
+    std::mt19937_64 rng(12345);
+    const char bases[4] = {'A', 'C', 'G', 'T'};
+    std::string db_str(length, 'A');
+    for (auto& c : db_str) c = bases[rng() & 3];
+    std::string q_str;
+    std::vector<int> q_of_db(length);
+    for (int i = 0; i < length; ++i) {
+        int roll = static_cast<int>(rng() % 1000);
+        if (roll < 5 * indels) {
+            for (int n = 1 + static_cast<int>(rng() % 4); n > 0; --n) q_str += bases[rng() & 3];
+        } else if (roll < 10 * indels) {
+            i += static_cast<int>(rng() % 4);
+            if (i >= length) break;
+        }
+        q_of_db[i] = static_cast<int>(q_str.size());
+        q_str += static_cast<int>(rng() % 100) >= identity ? bases[rng() & 3] : db_str[i];
+    }
+
+    for (int i = 1; i < length; ++i) {
+        if (q_of_db[i] == 0) q_of_db[i] = q_of_db[i - 1];  // Deleted base
+    }
+
+    PackedSeq db_packed, q_packed;
+    db_packed.append(db_str);
+    q_packed.append(q_str);
+    PackedView db = db_packed.view();
+    PackedView q = q_packed.view();
+
+    std::vector<int> anchors(num_anchors);
+    for (auto& a : anchors) a = static_cast<int>(rng() % (length * 9 / 10));
+
+    GappedOptions options;
+    std::cout << "gapped_bench: length=" << length << " identity=" << identity
+              << "% indels=" << indels << "% anchors=" << num_anchors
+              << " band=" << options.band << std::endl;
+
+    std::vector<GappedResult> expected;
+    bool all_ok = true;
+    double scalar_ns = 0;
+    const ExtensionKernel kernels[] = {
+        ExtensionKernel::Scalar, ExtensionKernel::Sse42, ExtensionKernel::Avx2
+    };
+    for (ExtensionKernel kernel : kernels) {
+        if (!extensionKernelSupported(kernel)) {
+            std::cout << "  " << extensionKernelName(kernel) << " not supported" << std::endl;
+            continue;
+        }
+        std::vector<GappedResult> results;
+        results.reserve(num_anchors);
+        long long columns = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int a : anchors) {
+            results.push_back(extendGappedWith(kernel, db, q, a, q_of_db[a], options));
+        }
+        double ns = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count() / num_anchors;
+
+        bool ok = true;
+        for (int n = 0; n < num_anchors; ++n) {
+            columns += results[n].db_end - results[n].db_start + 1;
+            ok = ok && consistent(results[n], db_str, q_str, options);
+            if (!expected.empty()) ok = ok && sameResult(results[n], expected[n]);
+        }
+        if (expected.empty()) {
+            expected = results;
+            scalar_ns = ns;
+        }
+        std::cout << "  " << extensionKernelName(kernel) << "  " << ns
+                  << " ns/extension  speedup " << scalar_ns / ns << "x"
+                  << "  (" << columns / num_anchors << " bases/alignment)"
+                  << (ok ? "" : "  MISMATCH") << std::endl;
+        all_ok = all_ok && ok;
+    }
+
+    return all_ok ? 0 : 1;
+}
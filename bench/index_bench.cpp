@@ -0,0 +1,93 @@
+// Benchmark for parallel index construction
+// Builds the same index with 1, 2, 4, ... up to max_threads threads, prints
+// the time spent in each phase, and checks that every build produces
+// exactly the arrays of the single-threaded one.
+//
+// Usage: index_bench [total_bases] [sequences] [k] [max_threads] [direct|hash]
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../index.h"
+
+static bool sameArrays(const KmerIndex& a, const KmerIndex& b) {
+    if (a.numKeys() != b.numKeys() || a.numOffsets() != b.numOffsets() ||
+        a.numPostings() != b.numPostings()) {
+        return false;
+    }
+    return (a.numKeys() == 0 ||
+            std::memcmp(a.keys(), b.keys(), a.numKeys() * sizeof(KmerKey)) == 0) &&
+           std::memcmp(a.offsets(), b.offsets(), a.numOffsets() * sizeof(uint64_t)) == 0 &&
+           std::memcmp(a.postings(), b.postings(), a.numPostings() * sizeof(Posting)) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    long long total_bases = argc > 1 ? std::atoll(argv[1]) : 20000000;
+    int num_seqs = argc > 2 ? std::atoi(argv[2]) : 50;
+    int k = argc > 3 ? std::atoi(argv[3]) : 11;
+    int max_threads = argc > 4 ? std::atoi(argv[4])
+                               : std::max(1u, std::thread::hardware_concurrency());
+    IndexLayout layout = argc > 5 && std::string(argv[5]) == "hash" ? IndexLayout::Hashed
+                                                                   : IndexLayout::Direct;
+
+    // Random sequences of uneven length with a few runs of N
+    std::mt19937_64 rng(12345);
+    const char bases[4] = {'A', 'C', 'G', 'T'};
+    std::vector<Sequence> database(num_seqs);
+    std::vector<std::string> names(num_seqs);
+    for (int i = 0; i < num_seqs; ++i) {
+        long long length = total_bases * 2 * (i + 1) / (static_cast<long long>(num_seqs) * (num_seqs + 1));
+        std::string bases_str(static_cast<size_t>(length), 'A');
+        for (auto& c : bases_str) c = bases[rng() & 3];
+        for (int n = 0; n < 3 && length > 100; ++n) {
+            size_t at = rng() % (length - 50);
+            std::fill(bases_str.begin() + at, bases_str.begin() + at + 20, 'N');
+        }
+        names[i] = "seq" + std::to_string(i);
+        database[i].id = names[i];
+        database[i].species = "synthetic";
+        database[i].index = i;
+        database[i].seq.append(bases_str);
+    }
+
+    std::cout << "index_bench: bases=" << total_bases << " sequences=" << num_seqs
+              << " k=" << k << " layout=" << (layout == IndexLayout::Direct ? "direct" : "hash")
+              << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    KmerIndex serial;
+    double serial_seconds = 0;
+    bool all_ok = true;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        IndexBuildStats stats;
+        KmerIndex index = buildIndex(database, SeedShape::contiguous(k), layout, DEFAULT_DIRECT_INDEX_BUDGET,
+                                     threads, &stats);
+        bool ok = true;
+        if (threads == 1) {
+            serial_seconds = stats.total_seconds;
+        } else {
+            ok = sameArrays(serial, index);
+        }
+        std::cout << "  threads=" << threads
+                  << "  keys " << stats.keys_seconds
+                  << "  table " << stats.table_seconds
+                  << "  count " << stats.count_seconds
+                  << "  prefix " << stats.prefix_seconds
+                  << "  place " << stats.place_seconds
+                  << "  total " << stats.total_seconds << " s"
+                  << "  speedup " << serial_seconds / stats.total_seconds << "x"
+                  << (ok ? "" : "  MISMATCH") << std::endl;
+        all_ok = all_ok && ok;
+        if (threads == 1) {
+            serial = std::move(index);
+        }
+    }
+
+    return all_ok ? 0 : 1;
+}
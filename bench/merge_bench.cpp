@@ -0,0 +1,147 @@
+// Regression check and microbenchmark for mergeHSPs
+// Compares the per-sequence sorted sweep against the original quadratic
+// merge on random HSP sets built to stress it (several sequences, both
+// strands, heavy overlap, tied starts, scores and identities), requiring
+// the same HSPs in the same order, then times both on one large set.
+//
+// Usage: merge_bench [sets] [hsps] [sequences]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../search.h"
+
+// Original merge: HSPs grouped by a linear find on the sequence ID, and
+// every HSP checked against every kept HSP of the whole result. It sorted
+// with std::sort, which leaves HSPs with equal starts in an unspecified
+// order; the sweep keeps them in input order, so the reference sorts
+// stably to pin that order down.
+static std::vector<HSP> referenceMerge(const std::vector<HSP>& hsps) {
+    if (hsps.empty()) return hsps;
+
+    std::vector<std::vector<HSP>> by_sequence;
+    std::vector<int> seq_ids;
+    for (const auto& hsp : hsps) {
+        auto it = std::find(seq_ids.begin(), seq_ids.end(), hsp.sid);
+        if (it == seq_ids.end()) {
+            seq_ids.push_back(hsp.sid);
+            by_sequence.push_back({hsp});
+        } else {
+            by_sequence[std::distance(seq_ids.begin(), it)].push_back(hsp);
+        }
+    }
+
+    std::vector<HSP> merged;
+    for (auto& seq_hsps : by_sequence) {
+        std::stable_sort(seq_hsps.begin(), seq_hsps.end(),
+            [](const HSP& a, const HSP& b) {
+                return a.db_start < b.db_start;
+            });
+        for (const HSP& hsp : seq_hsps) {
+            HSP* overlapping = nullptr;
+            for (auto& m : merged) {
+                if (m.sid == hsp.sid && m.minus_strand == hsp.minus_strand &&
+                    !(hsp.db_end < m.db_start || m.db_end < hsp.db_start)) {
+                    overlapping = &m;
+                    break;
+                }
+            }
+            if (!overlapping) {
+                merged.push_back(hsp);
+            } else if (hsp.score > overlapping->score ||
+                       (hsp.score == overlapping->score &&
+                        hsp.identity > overlapping->identity)) {
+                *overlapping = hsp;
+            }
+        }
+    }
+    return merged;
+}
+
+static bool sameHSPs(const std::vector<HSP>& a, const std::vector<HSP>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].sid != b[i].sid || a[i].db_start != b[i].db_start ||
+            a[i].db_end != b[i].db_end || a[i].q_start != b[i].q_start ||
+            a[i].q_end != b[i].q_end || a[i].score != b[i].score ||
+            a[i].identity != b[i].identity || a[i].cigar != b[i].cigar ||
+            a[i].minus_strand != b[i].minus_strand) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Random HSPs on `sequences` sequence IDs (spread out, so the buckets are
+// sparse) within a database span small enough for them to overlap a lot.
+// Scores and identities come from a handful of values so that ties are
+// common; q_start tells apart HSPs that are otherwise equal.
+static std::vector<HSP> randomHSPs(std::mt19937_64& rng, size_t count, int sequences,
+                                   int span) {
+    std::vector<HSP> hsps(count);
+    for (size_t i = 0; i < count; ++i) {
+        HSP& hsp = hsps[i];
+        hsp.sid = static_cast<int>(rng() % sequences) * 97;
+        hsp.db_start = static_cast<int>(rng() % span);
+        hsp.db_end = hsp.db_start + static_cast<int>(rng() % 60);
+        hsp.q_start = static_cast<int>(i);
+        hsp.q_end = hsp.q_start + (hsp.db_end - hsp.db_start);
+        hsp.score = 20 + static_cast<int>(rng() % 8);
+        hsp.identity = 90.0 + static_cast<double>(rng() % 4);
+        hsp.minus_strand = (rng() & 1) != 0;
+        if (rng() % 8 == 0) hsp.cigar = std::to_string(hsp.db_end - hsp.db_start + 1) + "M";
+    }
+    return hsps;
+}
+
+int main(int argc, char* argv[]) {
+    int num_sets = argc > 1 ? std::atoi(argv[1]) : 20000;
+    int large_hsps = argc > 2 ? std::atoi(argv[2]) : 20000;
+    int large_sequences = argc > 3 ? std::atoi(argv[3]) : 2000;
+
+    std::cout << "merge_bench: sets=" << num_sets << " hsps=" << large_hsps
+              << " sequences=" << large_sequences << std::endl;
+
+    // Random sets, from empty to a few hundred HSPs; each merge reuses the
+    // calling thread's scratch buffers left by the previous one
+    std::mt19937_64 rng(2024);
+    int mismatches = 0;
+    size_t checked_hsps = 0;
+    for (int set = 0; set < num_sets; ++set) {
+        size_t count = rng() % 300;
+        int sequences = 1 + static_cast<int>(rng() % 12);
+        int span = 20 + static_cast<int>(rng() % 2000);
+        std::vector<HSP> hsps = randomHSPs(rng, count, sequences, span);
+        checked_hsps += count;
+        if (!sameHSPs(mergeHSPs(hsps), referenceMerge(hsps))) {
+            if (mismatches == 0) {
+                std::cout << "  MISMATCH in set " << set << " (" << count << " HSPs)" << std::endl;
+            }
+            ++mismatches;
+        }
+    }
+    std::cout << "  random sets   " << num_sets << " sets, " << checked_hsps << " HSPs, "
+              << mismatches << " mismatches" << std::endl;
+
+    // One large set on many sequences, where the original merge is quadratic
+    std::vector<HSP> large = randomHSPs(rng, static_cast<size_t>(large_hsps),
+                                        large_sequences, 100000);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<HSP> expected = referenceMerge(large);
+    double ref_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    std::vector<HSP> merged = mergeHSPs(large);
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    bool large_ok = sameHSPs(merged, expected);
+    std::cout << "  reference     " << ref_ms << " ms" << std::endl;
+    std::cout << "  sweep         " << ms << " ms  speedup " << ref_ms / ms << "x"
+              << (large_ok ? "" : "  MISMATCH") << "  (" << merged.size() << " merged)"
+              << std::endl;
+
+    return mismatches == 0 && large_ok ? 0 : 1;
+}
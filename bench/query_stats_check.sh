@@ -0,0 +1,50 @@
+#!/bin/sh
+# Regression check for --stats-per-query with several threads
+# Searches many short synthetic reads with 1 and with 4 threads on each
+# strand setting and requires every query's counters (stage times vary, so
+# they are dropped) to be the same. Workers run ahead of the query being
+# printed, and one that reused its per-query slot too early would mix
+# counters of two queries into one line.
+#
+# Usage: bench/query_stats_check.sh [reads]   (run from the top directory
+# after make and make bench/synth)
+
+reads=${1:-3000}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+./bench/synth "$dir/data" reads="$reads" length=60 minus=0 > /dev/null 2>&1 || {
+    echo "query_stats_check: cannot generate data" >&2
+    exit 1
+}
+
+# One line of counters per query, in output order
+counters() {
+    ./simple_blastn --db "$dir/data.db.fa" --query "$dir/data.query.fa" \
+        --stats-per-query --strand "$1" --threads "$2" 2>&1 > /dev/null |
+        grep '^{"query"' | sed 's/, "search".*//'
+}
+
+echo "query_stats_check: reads=$reads threads=1 and 4"
+head -n 2 "$dir/data.query.fa" > "$dir/one.fa"
+if ! ./simple_blastn --db "$dir/data.db.fa" --query "$dir/one.fa" --stats-per-query \
+        > /dev/null 2>&1; then
+    echo "  skipped: simple_blastn was built without statistics (STATS=0)"
+    exit 0
+fi
+status=0
+for strand in plus minus both; do
+    counters "$strand" 1 > "$dir/expected"
+    counters "$strand" 4 > "$dir/actual"
+    queries=$(wc -l < "$dir/expected")
+    if [ "$queries" -ne "$reads" ]; then
+        echo "  --strand $strand: $queries of $reads queries reported  MISMATCH"
+        status=1
+    elif ! cmp -s "$dir/expected" "$dir/actual"; then
+        echo "  --strand $strand: $(diff "$dir/expected" "$dir/actual" | grep -c '^>') queries differ  MISMATCH"
+        status=1
+    else
+        echo "  --strand $strand: $queries queries match"
+    fi
+done
+exit $status
@@ -0,0 +1,307 @@
+// Benchmark suite on synthetic data, with a JSON report
+// Generates a genome and mutated reads with known origins (see
+// synthetic.h), then times k-mer encoding (encodeKmer, getKmerAt), index
+// construction, ungapped extension, the HSP search, HSP merging and whole
+// searches through SearchEngine (with the heap allocations they make once
+// warmed up), and counts the reads whose best hit is their true origin. The report goes to
+// stdout as one JSON object, so runs can be saved and compared between
+// commits; progress goes to stderr.
+//
+// Usage: suite_bench [k=11] [w=1] [key=value ...]   (generator keys: see setSyntheticOption)
+// w > 1 indexes only (w, k)-minimizers, to compare their size, speed and
+// recall with the full index. A second copy of the index is compressed
+// (KmerIndex::compressPostings) to report its bytes per posting, the block
+// decoder's throughput and the HSP search on it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../database.h"
+#include "../engine.h"
+#include "../index.h"
+#include "../scoring.h"
+#include "../search.h"
+#include "synthetic.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Heap allocations made by the program, to check that searches reuse
+// their workspace
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+
+// Out of line, or GCC warns that free() gets memory from new
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Per-operation time in nanoseconds
+static double nsPer(double seconds, size_t count) {
+    return count == 0 ? 0 : seconds * 1e9 / static_cast<double>(count);
+}
+
+int main(int argc, char* argv[]) {
+    GenomeOptions genome_options;
+    ReadOptions read_options;
+    int k = 11;
+    int window = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "k=") == 0) {
+            k = std::atoi(arg.c_str() + 2);
+        } else if (arg.compare(0, 2, "w=") == 0) {
+            window = std::atoi(arg.c_str() + 2);
+        } else if (!setSyntheticOption(arg, genome_options, read_options)) {
+            std::cerr << "Error: Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (k < 1 || k > 32) {
+        std::cerr << "Error: k must be 1 to 32" << std::endl;
+        return 1;
+    }
+    if (window < 1 || window > MAX_MINIMIZER_WINDOW) {
+        std::cerr << "Error: w must be 1 to " << MAX_MINIMIZER_WINDOW << std::endl;
+        return 1;
+    }
+
+    // Data
+    auto start = Clock::now();
+    std::vector<SyntheticRecord> genome = generateGenome(genome_options);
+    std::vector<ReadOrigin> origins;
+    std::vector<SyntheticRecord> reads = generateReads(genome, read_options, &origins);
+    std::vector<Sequence> database = toDatabase(genome);
+    std::vector<Query> queries = toQueries(reads);
+    double generate_seconds = secondsSince(start);
+    std::cerr << "suite_bench: generated " << genome.size() << " sequences and "
+              << reads.size() << " reads" << std::endl;
+
+    // K-mer encoding: the same random k-mers as strings and packed positions
+    const size_t num_kmers = 1000000;
+    std::mt19937_64 rng(7);
+    std::vector<std::pair<int, int>> kmer_at(num_kmers);
+    std::vector<std::string> kmer_text(num_kmers);
+    for (size_t i = 0; i < num_kmers; ++i) {
+        int sid = static_cast<int>(rng() % genome.size());
+        int length = static_cast<int>(genome[sid].bases.size());
+        int pos = length > k ? static_cast<int>(rng() % (length - k + 1)) : 0;
+        kmer_at[i] = {sid, pos};
+        kmer_text[i] = genome[sid].bases.substr(pos, k);
+    }
+    std::vector<KmerKey> encoded(num_kmers);
+    start = Clock::now();
+    for (size_t i = 0; i < num_kmers; ++i) encoded[i] = encodeKmer(kmer_text[i]);
+    double encode_seconds = secondsSince(start);
+    size_t kmer_mismatches = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < num_kmers; ++i) {
+        KmerKey key = 0;
+        getKmerAt(database[kmer_at[i].first].seq.view(), kmer_at[i].second, k, &key);
+        kmer_mismatches += key != encoded[i];
+    }
+    double get_kmer_seconds = secondsSince(start);
+
+    // Index construction
+    IndexBuildStats build_stats;
+    KmerIndex index = buildIndex(database, SeedShape::contiguous(k), IndexLayout::Auto,
+                                 DEFAULT_DIRECT_INDEX_BUDGET, 1, &build_stats, 0, window);
+    uint64_t genome_bases = 0;
+    for (const auto& record : genome) genome_bases += record.bases.size();
+    std::cerr << "suite_bench: indexed " << index.numPostings() << " k-mers" << std::endl;
+
+    // Ungapped extension from the middle of every plus-strand read's origin
+    DatabaseView db(database);
+    size_t extensions = 0;
+    int64_t extension_score = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < queries.size(); ++i) {
+        if (origins[i].minus) continue;
+        int q_length = static_cast<int>(queries[i].seq.length());
+        int middle = std::min(q_length, origins[i].db_end - origins[i].db_start + 1) / 2;
+        ExtensionResult ext = extendUngapped(db.seq(origins[i].sid), queries[i].seq.view(),
+                                             origins[i].db_start + middle, middle);
+        extension_score += ext.score;
+        ++extensions;
+    }
+    double extend_seconds = secondsSince(start);
+
+    // HSP search on the strands the reads were drawn from, every HSP kept
+    SearchOptions search_options;
+    std::vector<std::vector<HSP>> found(queries.size());
+    std::vector<HSP> minus_hsps;
+    size_t total_hsps = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < queries.size(); ++i) {
+        findHSPs(queries[i].seq.view(), db, index, search_options, found[i]);
+        if (read_options.minus_fraction > 0) {
+            PackedSeq minus = queries[i].seq.reverseComplement();
+            findHSPs(minus.view(), db, index, search_options, minus_hsps);
+            toMinusStrand(minus_hsps, static_cast<int>(queries[i].seq.length()));
+            found[i].insert(found[i].end(), minus_hsps.begin(), minus_hsps.end());
+        }
+        total_hsps += found[i].size();
+    }
+    double search_seconds = secondsSince(start);
+
+    // Merging, then the best hit of each read against its origin
+    std::vector<std::vector<HSP>> merged(queries.size());
+    size_t merged_hsps = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < queries.size(); ++i) {
+        merged[i] = mergeHSPs(found[i]);
+        merged_hsps += merged[i].size();
+    }
+    double merge_seconds = secondsSince(start);
+
+    // Compressed postings: every list decoded and checked against the
+    // plain index (built identically, so slot for slot), then the same
+    // HSP search as above on it
+    KmerIndex compressed = buildIndex(database, SeedShape::contiguous(k), IndexLayout::Auto,
+                                      DEFAULT_DIRECT_INDEX_BUDGET, 1, nullptr, 0, window);
+    start = Clock::now();
+    compressed.compressPostings(1);
+    double compress_seconds = secondsSince(start);
+    const uint64_t* plain_offsets = index.offsets();
+    const uint64_t* block_offsets = compressed.offsets();
+    std::vector<Posting> decoded(index.numPostings() + POSTING_BLOCK);
+    size_t decoded_postings = 0;
+    size_t list_mismatches = 0;
+    start = Clock::now();
+    for (size_t slot = 0; slot + 1 < compressed.numOffsets(); ++slot) {
+        PostingDecoder decoder(compressed.blocks() + block_offsets[slot],
+                               block_offsets[slot] == block_offsets[slot + 1]);
+        list_mismatches += decoder.size() != plain_offsets[slot + 1] - plain_offsets[slot];
+        while (size_t n = decoder.next(&decoded[decoded_postings])) decoded_postings += n;
+    }
+    double decode_seconds = secondsSince(start);
+    bool decode_ok = list_mismatches == 0 && decoded_postings == index.numPostings() &&
+                     std::equal(index.postings(), index.postings() + decoded_postings,
+                                decoded.begin());
+    size_t compressed_mismatches = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < queries.size(); ++i) {
+        std::vector<HSP> hsps;
+        findHSPs(queries[i].seq.view(), db, compressed, search_options, hsps);
+        if (read_options.minus_fraction > 0) {
+            PackedSeq minus = queries[i].seq.reverseComplement();
+            findHSPs(minus.view(), db, compressed, search_options, minus_hsps);
+            toMinusStrand(minus_hsps, static_cast<int>(queries[i].seq.length()));
+            hsps.insert(hsps.end(), minus_hsps.begin(), minus_hsps.end());
+        }
+        compressed_mismatches += !std::equal(hsps.begin(), hsps.end(),
+                                             found[i].begin(), found[i].end(),
+                                             [](const HSP& a, const HSP& b) {
+            return a.sid == b.sid && a.db_start == b.db_start && a.db_end == b.db_end &&
+                   a.q_start == b.q_start && a.q_end == b.q_end && a.score == b.score &&
+                   a.minus_strand == b.minus_strand;
+        });
+    }
+    double compressed_search_seconds = secondsSince(start);
+    
+
+    // Whole searches through the engine, both strands, best hit only: a
+    // first pass grows the workspace, the second is timed and counted
+    SearchEngine engine(db, index, search_options);
+    QueryOptions query_options;
+    query_options.strand = read_options.minus_fraction > 0 ? Strand::Both : Strand::Plus;
+    query_options.top_n = 1;
+    for (const Query& query : queries) engine.search(query.seq, query_options);
+    uint64_t allocations_before = allocations;
+    size_t engine_hits = 0;
+    start = Clock::now();
+    for (const Query& query : queries) engine_hits += engine.search(query.seq, query_options).size();
+    double engine_seconds = secondsSince(start);
+    uint64_t engine_allocations = allocations - allocations_before;
+    
+    size_t true_hits = 0;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        rankHSPs(merged[i], 1);
+        if (merged[i].empty()) continue;
+        const HSP& best = merged[i][0];
+        true_hits += best.sid == origins[i].sid && best.minus_strand == origins[i].minus &&
+                     best.db_start <= origins[i].db_end && origins[i].db_start <= best.db_end;
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "{\n"
+              << "  \"benchmark\": \"suite_bench\",\n"
+              << "  \"config\": {\n"
+              << "    \"k\": " << k << ",\n"
+              << "    \"w\": " << window << ",\n"
+              << "    \"genome_bases\": " << genome_bases << ",\n"
+              << "    \"sequences\": " << genome.size() << ",\n"
+              << "    \"gc\": " << genome_options.gc << ",\n"
+              << "    \"repeats\": " << genome_options.repeat_fraction << ",\n"
+              << "    \"reads\": " << reads.size() << ",\n"
+              << "    \"read_length\": " << read_options.length << ",\n"
+              << "    \"substitutions\": " << read_options.substitution_rate << ",\n"
+              << "    \"indels\": " << read_options.indel_rate << ",\n"
+              << "    \"minus\": " << read_options.minus_fraction << "\n"
+              << "  },\n"
+              << "  \"generate\": {\"seconds\": " << generate_seconds << "},\n"
+              << "  \"encode_kmer\": {\"calls\": " << num_kmers
+              << ", \"ns_per_call\": " << nsPer(encode_seconds, num_kmers) << "},\n"
+              << "  \"get_kmer_at\": {\"calls\": " << num_kmers
+              << ", \"ns_per_call\": " << nsPer(get_kmer_seconds, num_kmers)
+              << ", \"mismatches\": " << kmer_mismatches << "},\n"
+              << "  \"build_index\": {\"seconds\": " << build_stats.total_seconds
+              << ", \"layout\": \"" << (index.isDirect() ? "direct" : "hash") << "\""
+              << ", \"postings\": " << index.numPostings()
+              << ", \"memory_bytes\": " << index.memoryBytes()
+              << ", \"mbases_per_second\": "
+              << static_cast<double>(genome_bases) / 1e6 / build_stats.total_seconds << "},\n"
+              << "  \"extend_ungapped\": {\"calls\": " << extensions
+              << ", \"ns_per_call\": " << nsPer(extend_seconds, extensions)
+              << ", \"score_sum\": " << extension_score << "},\n"
+              << "  \"find_hsps\": {\"seconds\": " << search_seconds
+              << ", \"reads_per_second\": " << static_cast<double>(queries.size()) / search_seconds
+              << ", \"hsps\": " << total_hsps << "},\n"
+              << "  \"compressed_postings\": {\"compress_seconds\": " << compress_seconds
+              << ", \"block_bytes\": " << compressed.blockBytes()
+              << ", \"bytes_per_posting\": "
+              << (index.numPostings() == 0 ? 0.0 : static_cast<double>(compressed.blockBytes()) / static_cast<double>(index.numPostings()))
+              << ", \"uncompressed_bytes_per_posting\": " << sizeof(Posting)
+              << ", \"memory_bytes\": " << compressed.memoryBytes()
+              << ", \"decode_mpostings_per_second\": "
+              << static_cast<double>(decoded_postings) / 1e6 / decode_seconds
+              << ", \"decode_ok\": " << (decode_ok ? "true" : "false")
+              << ", \"find_hsps_seconds\": " << compressed_search_seconds
+              << ", \"hsp_mismatches\": " << compressed_mismatches << "},\n"
+              << "  \"merge_hsps\":{\"hsps\": " << total_hsps
+              << ", \"ns_per_hsp\": " << nsPer(merge_seconds, total_hsps)
+              << ", \"merged\": " << merged_hsps << "},\n"
+              << "  \"engine_search\": {\"reads_per_second\": "
+              << static_cast<double>(queries.size()) / engine_seconds
+              << ", \"hits\": " << engine_hits
+              << ", \"allocations_per_read\": "
+              << (queries.empty() ? 0.0 : static_cast<double>(engine_allocations) / static_cast<double>(queries.size()))
+              << "},\n"
+              << "  \"accuracy\": {\"reads\": " << queries.size()
+              << ", \"true_best_hits\": " << true_hits
+              << ", \"recall\": "
+              << (queries.empty() ? 0.0 : static_cast<double>(true_hits) / static_cast<double>(queries.size()))
+              << "}\n"
+              << "}" << std::endl;
+
+    return kmer_mismatches == 0 && decode_ok && compressed_mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+// Synthetic data generator
+// Writes a reference genome and mutated reads sampled from it, with the
+// true origin of every read, so full runs of simple_blastn can be timed
+// and checked at any scale:
+//   <prefix>.db.fa     database FASTA
+//   <prefix>.query.fa  query FASTA
+//   <prefix>.truth.tsv read, sequence, 1-based start and end, strand
+//
+// Usage: synth <prefix> [key=value ...]   (keys: see setSyntheticOption)
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "synthetic.h"
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <prefix> [key=value ...]" << std::endl;
+        return 1;
+    }
+    std::string prefix = argv[1];
+    GenomeOptions genome_options;
+    ReadOptions read_options;
+    for (int i = 2; i < argc; ++i) {
+        if (!setSyntheticOption(argv[i], genome_options, read_options)) {
+            std::cerr << "Error: Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<SyntheticRecord> genome = generateGenome(genome_options);
+    std::vector<ReadOrigin> origins;
+    std::vector<SyntheticRecord> reads = generateReads(genome, read_options, &origins);
+
+    std::ofstream db_file(prefix + ".db.fa");
+    std::ofstream query_file(prefix + ".query.fa");
+    std::ofstream truth_file(prefix + ".truth.tsv");
+    if (!db_file || !query_file || !truth_file) {
+        std::cerr << "Error: Cannot write " << prefix << ".*" << std::endl;
+        return 1;
+    }
+    writeFasta(db_file, genome);
+    writeFasta(query_file, reads);
+    for (size_t i = 0; i < reads.size(); ++i) {
+        const ReadOrigin& origin = origins[i];
+        truth_file << reads[i].name << '\t' << genome[origin.sid].name << '\t'
+                   << origin.db_start + 1 << '\t' << origin.db_end + 1 << '\t'
+                   << (origin.minus ? "minus" : "plus") << '\n';
+    }
+    if (!db_file.flush() || !query_file.flush() || !truth_file.flush()) {
+        std::cerr << "Error: Cannot write " << prefix << ".*" << std::endl;
+        return 1;
+    }
+    std::cerr << "synth: " << genome.size() << " sequences, " << reads.size() << " reads" << std::endl;
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include "synthetic.h"
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+
+namespace {
+
+// Uniform double in [0, 1)
+double uniform(std::mt19937_64& rng) {
+    return static_cast<double>(rng() >> 11) * 0x1.0p-53;
+}
+
+// Uniform integer in [0, n)
+uint64_t below(std::mt19937_64& rng, uint64_t n) {
+    return n == 0 ? 0 : rng() % n;
+}
+
+char randomBase(std::mt19937_64& rng, double gc) {
+    double roll = uniform(rng);
+    if (roll < gc) return roll < gc / 2 ? 'G' : 'C';
+    return roll < gc + (1 - gc) / 2 ? 'A' : 'T';
+}
+
+// A base other than c
+char substitute(std::mt19937_64& rng, char c) {
+    static const char bases[4] = {'A', 'C', 'G', 'T'};
+    char other;
+    do {
+        other = bases[rng() & 3];
+    } while (other == c);
+    return other;
+}
+
+void reverseComplement(std::string& bases) {
+    std::reverse(bases.begin(), bases.end());
+    for (char& c : bases) {
+        switch (c) {
+            case 'A': c = 'T'; break;
+            case 'C': c = 'G'; break;
+            case 'G': c = 'C'; break;
+            case 'T': c = 'A'; break;
+            default: break;
+        }
+    }
+}
+
+} // namespace
+
+bool setSyntheticOption(const std::string& arg, GenomeOptions& genome, ReadOptions& reads) {
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos) return false;
+    std::string key = arg.substr(0, eq);
+    const char* value = arg.c_str() + eq + 1;
+    if (key == "bases") genome.total_bases = std::strtoull(value, nullptr, 10);
+    else if (key == "sequences") genome.sequences = std::atoi(value);
+    else if (key == "gc") genome.gc = std::atof(value);
+    else if (key == "repeats") genome.repeat_fraction = std::atof(value);
+    else if (key == "repeat_families") genome.repeat_families = std::atoi(value);
+    else if (key == "repeat_length") genome.repeat_length = std::atoi(value);
+    else if (key == "repeat_divergence") genome.repeat_divergence = std::atof(value);
+    else if (key == "genome_seed") genome.seed = std::strtoull(value, nullptr, 10);
+    else if (key == "reads") reads.count = std::atoi(value);
+    else if (key == "length") reads.length = std::atoi(value);
+    else if (key == "substitutions") reads.substitution_rate = std::atof(value);
+    else if (key == "indels") reads.indel_rate = std::atof(value);
+    else if (key == "minus") reads.minus_fraction = std::atof(value);
+    else if (key == "read_seed") reads.seed = std::strtoull(value, nullptr, 10);
+    else return false;
+    return true;
+}
+
+std::vector<SyntheticRecord> generateGenome(const GenomeOptions& options) {
+    std::mt19937_64 rng(options.seed);
+    int num_seqs = std::max(1, options.sequences);
+    std::vector<SyntheticRecord> genome(num_seqs);
+    uint64_t parts = static_cast<uint64_t>(num_seqs) * (num_seqs + 1) / 2;
+    for (int i = 0; i < num_seqs; ++i) {
+        uint64_t length = std::max<uint64_t>(1, options.total_bases * (i + 1) / parts);
+        genome[i].name = "chr" + std::to_string(i + 1);
+        genome[i].species = "synthetic";
+        genome[i].bases.resize(length);
+        for (char& c : genome[i].bases) c = randomBase(rng, options.gc);
+    }
+
+    // Repeat families, pasted over random positions in either orientation
+    // until they cover repeat_fraction of the genome
+    int repeat_length = std::max(1, options.repeat_length);
+    std::vector<std::string> families(std::max(0, options.repeat_families));
+    for (auto& family : families) {
+        family.resize(repeat_length);
+        for (char& c : family) c = randomBase(rng, options.gc);
+    }
+    uint64_t target = static_cast<uint64_t>(options.repeat_fraction *
+                                            static_cast<double>(options.total_bases));
+    uint64_t pasted = 0;
+    while (!families.empty() && pasted < target) {
+        SyntheticRecord& record = genome[below(rng, genome.size())];
+        if (record.bases.size() < static_cast<size_t>(repeat_length)) break;
+        std::string copy = families[below(rng, families.size())];
+        for (char& c : copy) {
+            if (uniform(rng) < options.repeat_divergence) c = substitute(rng, c);
+        }
+        if (rng() & 1) reverseComplement(copy);
+        size_t at = below(rng, record.bases.size() - repeat_length + 1);
+        std::copy(copy.begin(), copy.end(), record.bases.begin() + at);
+        pasted += repeat_length;
+    }
+    return genome;
+}
+
+std::vector<SyntheticRecord> generateReads(const std::vector<SyntheticRecord>& genome,
+                                           const ReadOptions& options,
+                                           std::vector<ReadOrigin>* origins) {
+    std::mt19937_64 rng(options.seed);
+    std::vector<uint64_t> ends;  // Cumulative genome length, to pick by length
+    uint64_t total = 0;
+    for (const auto& record : genome) {
+        total += record.bases.size();
+        ends.push_back(total);
+    }
+
+    std::vector<SyntheticRecord> reads;
+    reads.reserve(options.count);
+    if (origins) origins->clear();
+    for (int i = 0; i < options.count && total > 0; ++i) {
+        uint64_t at = below(rng, total);
+        int sid = static_cast<int>(std::upper_bound(ends.begin(), ends.end(), at) - ends.begin());
+        const std::string& source = genome[sid].bases;
+        int source_length = static_cast<int>(source.size());
+        int length = std::min(options.length, source_length);
+        int start = static_cast<int>(below(rng, source_length - length + 1));
+
+        // Copy the range with substitutions, insertions and deletions
+        SyntheticRecord read;
+        read.name = "read" + std::to_string(i + 1);
+        read.species = "query";
+        read.bases.reserve(length + length / 8);
+        int pos = start;
+        while (pos < start + length) {
+            double roll = uniform(rng);
+            if (roll < options.indel_rate / 2) {
+                read.bases += randomBase(rng, 0.5);
+                continue;
+            }
+            if (roll < options.indel_rate) {
+                ++pos;
+                continue;
+            }
+            char c = source[pos++];
+            read.bases += uniform(rng) < options.substitution_rate ? substitute(rng, c) : c;
+        }
+        bool minus = uniform(rng) < options.minus_fraction;
+        if (minus) reverseComplement(read.bases);
+        if (origins) origins->push_back(ReadOrigin{sid, start, start + length - 1, minus});
+        reads.push_back(std::move(read));
+    }
+    return reads;
+}
+
+void writeFasta(std::ostream& out, const std::vector<SyntheticRecord>& records) {
+    for (const auto& record : records) {
+        out << '>' << record.name << '|' << record.species << '\n';
+        for (size_t i = 0; i < record.bases.size(); i += 80) {
+            out.write(record.bases.data() + i,
+                      static_cast<std::streamsize>(std::min<size_t>(80, record.bases.size() - i)));
+            out << '\n';
+        }
+    }
+}
+
+std::vector<Sequence> toDatabase(const std::vector<SyntheticRecord>& records) {
+    std::vector<Sequence> database(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        database[i].id = records[i].name;
+        database[i].species = records[i].species;
+        database[i].index = static_cast<int>(i);
+        database[i].seq.append(records[i].bases);
+    }
+    return database;
+}
+
+std::vector<Query> toQueries(const std::vector<SyntheticRecord>& records) {
+    std::vector<Query> queries(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        queries[i].name = records[i].name;
+        queries[i].seq.append(records[i].bases);
+    }
+    return queries;
+}
@@ -0,0 +1,74 @@
+#ifndef BENCH_SYNTHETIC_H
+#define BENCH_SYNTHETIC_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "../fasta.h"
+
+// Deterministic synthetic data for benchmarks. Everything is drawn from
+// mt19937_64 with plain bit arithmetic (no std distributions, whose
+// output differs between standard libraries), so the same options give
+// the same bases on every machine.
+
+// Reference genome parameters
+struct GenomeOptions {
+    uint64_t seed = 1;
+    uint64_t total_bases = 4000000;
+    int sequences = 20;              // Lengths grow linearly: 1, 2, 3, ... parts
+    double gc = 0.5;                 // Fraction of G and C
+    double repeat_fraction = 0.05;   // Fraction of bases covered by repeat copies
+    int repeat_families = 8;
+    int repeat_length = 300;
+    double repeat_divergence = 0.05; // Substitutions per base in each copy
+};
+
+// Query (read) parameters
+struct ReadOptions {
+    uint64_t seed = 2;
+    int count = 10000;
+    int length = 150;
+    double substitution_rate = 0.02;
+    double indel_rate = 0.002;       // Half insertions, half deletions
+    double minus_fraction = 0.0;     // Reads taken from the reverse strand
+};
+
+// Generated FASTA record: the header is "name|species"
+struct SyntheticRecord {
+    std::string name;
+    std::string species;
+    std::string bases;
+};
+
+// Where a read came from: database range [db_start, db_end] of sid
+struct ReadOrigin {
+    int sid;
+    int db_start;
+    int db_end;
+    bool minus;
+};
+
+// Set one generator option from a "key=value" argument. Keys: bases,
+// sequences, gc, repeats, repeat_families, repeat_length,
+// repeat_divergence, genome_seed, reads, length, substitutions, indels,
+// minus, read_seed. Returns false for an unknown key.
+bool setSyntheticOption(const std::string& arg, GenomeOptions& genome, ReadOptions& reads);
+
+std::vector<SyntheticRecord> generateGenome(const GenomeOptions& options);
+
+// Reads sampled uniformly from genome bases, with mutations; origins[i]
+// is the true position of read i
+std::vector<SyntheticRecord> generateReads(const std::vector<SyntheticRecord>& genome,
+                                           const ReadOptions& options,
+                                           std::vector<ReadOrigin>* origins);
+
+// FASTA with 80-column lines
+void writeFasta(std::ostream& out, const std::vector<SyntheticRecord>& records);
+
+// Parsed forms of generated records; ids and names point into records,
+// which must outlive the result
+std::vector<Sequence> toDatabase(const std::vector<SyntheticRecord>& records);
+std::vector<Query> toQueries(const std::vector<SyntheticRecord>& records);
+
+#endif // BENCH_SYNTHETIC_H
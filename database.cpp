@@ -0,0 +1,28 @@
+#include "database.h"
+#include "indexfile.h"
+
+DatabaseView::DatabaseView(const std::vector<Sequence>& database)
+    : parsed_(&database) {}
+
+DatabaseView::DatabaseView(const MappedIndex& mapped)
+    : mapped_(&mapped) {}
+
+int DatabaseView::size() const {
+    return parsed_ ? static_cast<int>(parsed_->size()) : mapped_->size();
+}
+
+std::string_view DatabaseView::id(int sid) const {
+    return parsed_ ? std::string_view((*parsed_)[sid].id) : mapped_->id(sid);
+}
+
+std::string_view DatabaseView::species(int sid) const {
+    return parsed_ ? std::string_view((*parsed_)[sid].species) : mapped_->species(sid);
+}
+
+PackedView DatabaseView::seq(int sid) const {
+    return parsed_ ? (*parsed_)[sid].seq.view() : mapped_->seq(sid);
+}
+
+const std::vector<MaskInterval>* DatabaseView::mask(int sid) const {
+    return parsed_ ? &(*parsed_)[sid].mask : nullptr;
+}
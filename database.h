@@ -0,0 +1,32 @@
+#ifndef DATABASE_H
+#define DATABASE_H
+
+#include <string_view>
+#include <vector>
+#include "fasta.h"
+
+class MappedIndex;
+
+// Read-only access to database sequences by index, backed either by the
+// records returned from parseDatabase or by a mapped index file, so the
+// search and output code works the same for both
+class DatabaseView {
+public:
+    DatabaseView(const std::vector<Sequence>& database);
+    DatabaseView(const MappedIndex& mapped);
+
+    int size() const;
+    std::string_view id(int sid) const;
+    std::string_view species(int sid) const;
+    PackedView seq(int sid) const;
+
+    // Low-complexity intervals of a sequence (see dustDatabase), or null
+    // for a mapped index file, which does not keep them
+    const std::vector<MaskInterval>* mask(int sid) const;
+
+private:
+    const std::vector<Sequence>* parsed_ = nullptr;
+    const MappedIndex* mapped_ = nullptr;
+};
+
+#endif // DATABASE_H
@@ -0,0 +1,102 @@
+#include "dust.h"
+#include <algorithm>
+
+// Score one window of triplets and, if it passes the threshold, mask its
+// best-scoring subinterval. trip holds the window's triplet codes;
+// [start, start + n + 2) are the bases they cover.
+static void dustWindow(const unsigned char* trip, size_t n, size_t start,
+                       const DustOptions& options, std::vector<MaskInterval>& mask) {
+    if (n < 2) return;
+    
+    // Whole window: r = sum c_t (c_t - 1) / 2, built up one triplet at a time
+    unsigned counts[64] = {};
+    uint64_t r = 0;
+    for (size_t j = 0; j < n; ++j) {
+        r += counts[trip[j]]++;
+    }
+    if (r * 10 <= static_cast<uint64_t>(options.level) * (n - 1)) return;
+    
+    // Best subinterval: score every prefix of every suffix, compared as
+    // fractions r / (m - 1) to stay in integers
+    uint64_t best_r = 0, best_den = 1;
+    size_t best_first = 0, best_last = 0;
+    for (size_t i = 0; i + 1 < n; ++i) {
+        std::fill(counts, counts + 64, 0);
+        r = 0;
+        for (size_t j = i; j < n; ++j) {
+            r += counts[trip[j]]++;
+            uint64_t den = j - i;  // Triplets - 1
+            if (den > 0 && r * best_den > best_r * den) {
+                best_r = r;
+                best_den = den;
+                best_first = i;
+                best_last = j;
+            }
+        }
+    }
+    if (best_r * 10 > static_cast<uint64_t>(options.level) * best_den) {
+        mask.push_back({static_cast<uint32_t>(start + best_first),
+                        static_cast<uint32_t>(best_last - best_first + 3)});
+    }
+}
+
+// Windows overlap by half, so a repeat is seen whole by at least one
+// window unless it is longer than half a window
+std::vector<MaskInterval> dustMask(const PackedView& seq, const DustOptions& options) {
+    std::vector<MaskInterval> mask;
+    dustMask(seq, options, mask);
+    return mask;
+}
+
+void dustMask(const PackedView& seq, const DustOptions& options, std::vector<MaskInterval>& mask) {
+    mask.clear();
+    size_t window = static_cast<size_t>(std::max(options.window, 4));
+    size_t step = window / 2;
+    thread_local std::vector<unsigned char> trip;
+    
+    // Segments between ambiguity runs
+    size_t seg_start = 0;
+    for (size_t r = 0; r <= seq.num_runs; ++r) {
+        size_t seg_end = r < seq.num_runs ? seq.runs[r].pos : seq.length;
+        if (seg_end >= seg_start + 3) {
+            trip.resize(seg_end - seg_start - 2);
+            unsigned code = (seq.code(seg_start) << 2) | seq.code(seg_start + 1);
+            for (size_t i = 0; i < trip.size(); ++i) {
+                code = ((code << 2) | seq.code(seg_start + i + 2)) & 63;
+                trip[i] = static_cast<unsigned char>(code);
+            }
+            for (size_t start = 0; start < trip.size(); start += step) {
+                size_t n = std::min(window - 2, trip.size() - start);
+                dustWindow(trip.data() + start, n, seg_start + start, options, mask);
+                if (start + n == trip.size()) break;
+            }
+        }
+        if (r < seq.num_runs) {
+            seg_start = static_cast<size_t>(seq.runs[r].pos) + seq.runs[r].len;
+        }
+    }
+    
+    // Sort and merge overlapping or touching intervals
+    std::sort(mask.begin(), mask.end(), [](const MaskInterval& a, const MaskInterval& b) {
+        return a.pos < b.pos;
+    });
+    size_t out = 0;
+    for (size_t i = 0; i < mask.size(); ++i) {
+        if (out > 0 && mask[i].pos <= mask[out - 1].pos + mask[out - 1].len) {
+            uint32_t end = std::max(mask[out - 1].pos + mask[out - 1].len,
+                                    mask[i].pos + mask[i].len);
+            mask[out - 1].len = end - mask[out - 1].pos;
+        } else {
+            mask[out++] = mask[i];
+        }
+    }
+    mask.resize(out);
+}
+
+size_t maskedBases(const std::vector<MaskInterval>& mask) {
+    size_t total = 0;
+    for (const MaskInterval& interval : mask) {
+        total += interval.len;
+    }
+    return total;
+}
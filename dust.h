@@ -0,0 +1,29 @@
+#ifndef DUST_H
+#define DUST_H
+
+#include <cstddef>
+#include <vector>
+#include "packed.h"
+
+// DUST low-complexity masking parameters
+struct DustOptions {
+    int level = 20;       // Score threshold, in tenths (see dustMask)
+    int window = 64;      // Window length in bases
+};
+
+// Find the low-complexity regions of a sequence with DUST. Windows of
+// options.window bases, every half window, are scored on the counts c_t of
+// their 64 possible triplets as sum c_t (c_t - 1) / 2 / (l - 1), with l the
+// number of triplets. For a window scoring above options.level / 10, the
+// subinterval with the highest score is masked. Random sequence scores
+// about 0.5; poly-A and short tandem repeats score far higher. Triplets
+// never span an ambiguity run. Returns sorted, merged intervals.
+std::vector<MaskInterval> dustMask(const PackedView& seq, const DustOptions& options);
+
+// Same, into a caller-owned vector (cleared first) whose capacity is reused
+void dustMask(const PackedView& seq, const DustOptions& options, std::vector<MaskInterval>& mask);
+
+// Total bases covered by mask intervals
+size_t maskedBases(const std::vector<MaskInterval>& mask);
+
+#endif // DUST_H
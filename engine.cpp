@@ -0,0 +1,119 @@
+#include "engine.h"
+#include "parallel.h"
+#include "stats.h"
+
+SearchEngine::SearchEngine(const DatabaseView& database, const KmerIndex& index,
+                           const SearchOptions& search_options, const DustOptions& dust_options)
+    : database_(database), index_(&index), shape_(index.shape()),
+      search_options_(search_options), dust_options_(dust_options) {}
+
+SearchEngine::SearchEngine(const DatabaseView& database, const SeedShape& shape,
+                           const SearchOptions& search_options, const DustOptions& dust_options)
+    : database_(database), index_(nullptr), shape_(shape),
+      search_options_(search_options), dust_options_(dust_options) {}
+
+const std::vector<HSP>& SearchEngine::search(const PackedSeq& query,
+                                             const QueryOptions& options) const {
+    thread_local QueryWorkspace workspace;
+    return search(query, options, workspace);
+}
+
+const std::vector<HSP>& SearchEngine::search(const PackedSeq& query, const QueryOptions& options,
+                                             QueryWorkspace& workspace) const {
+    for (size_t s = 0; s < strands(options); ++s) {
+        searchStrand(query, options, workspace, s);
+    }
+    return collectHits(options, workspace);
+}
+
+// Low-complexity regions of the strand start no seeds, and the reverse
+// complement is derived straight from the packed query
+void SearchEngine::searchStrand(const PackedSeq& query, const QueryOptions& options,
+                                QueryWorkspace& workspace, size_t s) const {
+    std::vector<HSP>& hsps = workspace.hsps[s];
+    bool minus = options.strand == Strand::Minus || s == 1;
+    if (minus) {
+        query.reverseComplement(workspace.minus);
+    }
+    PackedView searched = minus ? workspace.minus.view() : query.view();
+    const std::vector<MaskInterval>* mask = nullptr;
+    if (dust_options_.level > 0) {
+        dustMask(searched, dust_options_, workspace.mask[s]);
+        mask = &workspace.mask[s];
+    }
+    workspace.top[s].reset(options.top_n);
+    findHSPs(searched, database_, *index_, search_options_, hsps, mask, &workspace.top[s]);
+    if (minus) {
+        toMinusStrand(hsps, static_cast<int>(query.length()));
+    }
+}
+
+// Merge overlapping HSPs of every strand, then keep the best top_n; either
+// strand's threshold bounds the top hits of both
+const std::vector<HSP>& SearchEngine::collectHits(const QueryOptions& options,
+                                                  QueryWorkspace& workspace) const {
+    STATS_COUNT(Counter::Queries, 1);
+    STATS_TIMER(Stage::Merge);
+    if (strands(options) == 2) {
+        workspace.hsps[0].insert(workspace.hsps[0].end(),
+                                 workspace.hsps[1].begin(), workspace.hsps[1].end());
+        const TopHits& higher = workspace.top[1].threshold() > workspace.top[0].threshold()
+            ? workspace.top[1] : workspace.top[0];
+        higher.prune(workspace.hsps[0]);
+    }
+    mergeHSPs(workspace.hsps[0], workspace.hits);
+    STATS_COUNT(Counter::HspsMerged, workspace.hits.size());
+
+    // Score (descending), then identity (descending)
+    rankHSPs(workspace.hits, options.top_n);
+    STATS_COUNT(Counter::HspsReported, workspace.hits.size());
+    return workspace.hits;
+}
+
+bool SearchEngine::canSearchBatches() const {
+    if (!index_) return true;
+    const IndexFilterStats& filter = index_->filterStats();
+    return index_->window() == 1 && filter.stopped_kmers == 0 &&
+           (filter.masked_bases == 0 || (database_.size() > 0 && database_.mask(0) != nullptr));
+}
+
+// Strand s of query i is strand i * strands + s of the batch, and is
+// prepared in workspaces[i] just as searchStrand would prepare it
+void SearchEngine::searchBatch(const std::vector<Query>& queries, const QueryOptions& options,
+                               std::vector<QueryWorkspace>& workspaces, int threads) const {
+    size_t num_strands = strands(options);
+    workspaces.resize(queries.size());
+    std::vector<Sequence> batch(queries.size() * num_strands);
+    parallelFor(queries.size(), threads, [&](size_t i, int) {
+        QueryWorkspace& workspace = workspaces[i];
+        for (size_t s = 0; s < num_strands; ++s) {
+            bool minus = options.strand == Strand::Minus || s == 1;
+            if (minus) {
+                queries[i].seq.reverseComplement(workspace.minus);
+            }
+            Sequence& strand = batch[i * num_strands + s];
+            strand.seq = minus ? workspace.minus : queries[i].seq;
+            strand.index = static_cast<int>(i * num_strands + s);
+            workspace.mask[s].clear();
+            if (dust_options_.level > 0) {
+                dustMask(strand.seq.view(), dust_options_, workspace.mask[s]);
+                strand.mask = workspace.mask[s];
+            }
+        }
+    });
+
+    std::vector<std::vector<HSP>> hsps;
+    std::vector<TopHits> tops;
+    findBatchHSPs(batch, database_, shape_, search_options_, options.top_n, threads,
+                  hsps, tops);
+    for (size_t i = 0; i < queries.size(); ++i) {
+        for (size_t s = 0; s < num_strands; ++s) {
+            size_t j = i * num_strands + s;
+            workspaces[i].hsps[s].swap(hsps[j]);
+            workspaces[i].top[s] = tops[j];
+            if (options.strand == Strand::Minus || s == 1) {
+                toMinusStrand(workspaces[i].hsps[s], static_cast<int>(queries[i].seq.length()));
+            }
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <vector>
+#include "database.h"
+#include "dust.h"
+#include "index.h"
+#include "packed.h"
+#include "search.h"
+
+// Per-query choices of a search
+struct QueryOptions {
+    Strand strand = Strand::Plus;
+    int top_n = 2;     // Hits to keep (0 = all)
+};
+
+// Everything a search writes, reused from one query to the next. Once its
+// vectors have grown to fit the largest query and result seen, searching
+// with it does not allocate (gapped alignments still allocate their CIGAR
+// strings). The two strands of one query may be searched concurrently with
+// the same workspace; anything else needs one workspace per thread.
+struct QueryWorkspace {
+    PackedSeq minus;                    // Reverse complement of the query
+    std::vector<HSP> hsps[2];           // Plus (or the only strand), then minus
+    std::vector<MaskInterval> mask[2];  // Low-complexity intervals of each strand
+    TopHits top[2];                     // Best hits of each strand so far
+    std::vector<HSP> hits;              // Merged and ranked hits of the query
+};
+
+// Search engine over one database and its k-mer index, for programs that
+// embed the search. Searches only read the engine, so any number of
+// threads can share one, each with its own workspace.
+//
+//     std::vector<Sequence> database = parseDatabase(fasta);
+//     KmerIndex index = buildIndex(database, SeedShape::contiguous(11));
+//     SearchEngine engine(DatabaseView(database), index);
+//     const std::vector<HSP>& hits = engine.search(query.seq, QueryOptions());
+class SearchEngine {
+public:
+    // The database and index must outlive the engine. With dust_options.level
+    // above 0, queries are masked with DUST before seeding (the database is
+    // masked when the index is built).
+    SearchEngine(const DatabaseView& database, const KmerIndex& index,
+                 const SearchOptions& search_options = SearchOptions(),
+                 const DustOptions& dust_options = DustOptions{0});
+
+    // An engine without a database index, which can only searchBatch
+    SearchEngine(const DatabaseView& database, const SeedShape& shape,
+                 const SearchOptions& search_options = SearchOptions(),
+                 const DustOptions& dust_options = DustOptions{0});
+
+    const DatabaseView& database() const { return database_; }
+    bool hasIndex() const { return index_ != nullptr; }
+    const KmerIndex& index() const { return *index_; }
+    const SeedShape& shape() const { return shape_; }
+    const SearchOptions& searchOptions() const { return search_options_; }
+    const DustOptions& dustOptions() const { return dust_options_; }
+
+    // Search both strands of query as options asks and return its hits,
+    // best first. The hits live in the calling thread's own workspace and
+    // stay valid until the thread's next search.
+    const std::vector<HSP>& search(const PackedSeq& query, const QueryOptions& options) const;
+
+    // Same, in a caller-owned workspace; the hits are workspace.hits
+    const std::vector<HSP>& search(const PackedSeq& query, const QueryOptions& options,
+                                   QueryWorkspace& workspace) const;
+
+    // The two steps of search, for callers that search the strands of a
+    // query on different threads: searchStrand for each s in
+    // [0, strands(options)), then collectHits once all of them are done.
+    // Strand 1 (with Strand::Both) and the only strand of Strand::Minus
+    // search the reverse complement, which that strand computes itself.
+    static size_t strands(const QueryOptions& options) {
+        return options.strand == Strand::Both ? 2 : 1;
+    }
+    void searchStrand(const PackedSeq& query, const QueryOptions& options,
+                      QueryWorkspace& workspace, size_t s) const;
+    const std::vector<HSP>& collectHits(const QueryOptions& options,
+                                        QueryWorkspace& workspace) const;
+
+    // Whether searchBatch gives the same hits as searching each query with
+    // the index: it holds every seed with no stop list, and the database
+    // masks are known (a mapped index file keeps none, so it must have been
+    // built without DUST)
+    bool canSearchBatches() const;
+
+    // Search a batch of queries the other way round, on `threads` workers:
+    // index the queries and stream the database once (see findBatchHSPs).
+    // This pays off when the database has no index yet and the batch is
+    // much smaller than the database. Afterwards workspaces[i] (resized to one per query) holds
+    // query i as if searchStrand had searched each of its strands; call
+    // collectHits for its hits.
+    void searchBatch(const std::vector<Query>& queries, const QueryOptions& options,
+                     std::vector<QueryWorkspace>& workspaces, int threads) const;
+
+private:
+    DatabaseView database_;
+    const KmerIndex* index_;
+    SeedShape shape_;
+    SearchOptions search_options_;
+    DustOptions dust_options_;
+};
+
+#endif // ENGINE_H
@@ -1,45 +1,153 @@
 #include "fasta.h"
-#include <fstream>
-#include <sstream>
-#include <iostream>
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FastaFile::~FastaFile() {
+    close();
+}
+
+void FastaFile::close() {
+    if (mapped_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    open_ = false;
+    mapped_ = false;
+    buffer_.clear();
+    buffer_.shrink_to_fit();
+}
+
+bool FastaFile::open(const std::string& filename, const char* kind) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: Cannot open " << kind << " file: " << filename << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t length = static_cast<size_t>(st.st_size);
+        void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            // Parsing reads the file front to back once
+            madvise(addr, length, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(addr);
+            size_ = length;
+            mapped_ = true;
+        }
+    }
+
+    // Pipes, empty files and files that cannot be mapped are read in full
+    if (!mapped_) {
+        char chunk[1 << 16];
+        ssize_t n;
+        while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+            buffer_.append(chunk, static_cast<size_t>(n));
+        }
+        if (n < 0) {
+            std::cerr << "Error: Cannot read " << kind << " file: " << filename << std::endl;
+            ::close(fd);
+            close();
+            return false;
+        }
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+    }
+
+    ::close(fd);
+    open_ = true;
+    return true;
+}
+
+// First '>' that starts a line, searching from the line start p
+// memchr compares a whole vector of bytes per step, so the sequence lines
+// in between are skipped at memory speed
+static const char* nextHeader(const char* p, const char* end) {
+    if (p >= end || *p == '>') return p;
+    while (true) {
+        const void* found = std::memchr(p, '>', static_cast<size_t>(end - p));
+        if (found == nullptr) return end;
+        const char* gt = static_cast<const char*>(found);
+        if (gt[-1] == '\n') return gt;
+        p = gt + 1;
+    }
+}
+
+// Call fn(header, has_header, body, body_end) for each record of the file,
+// where header is the header line without '>' and [body, body_end) holds
+// the record's sequence lines. Lines before the first header form a record
+// without one.
+template <typename Fn>
+static void forEachRecord(const char* data, size_t size, Fn fn) {
+    const char* p = data;
+    const char* end = p + size;
+    const char* record = nextHeader(p, end);
+    if (record != p) {
+        fn(std::string_view(), false, p, record);
+    }
+    while (record < end) {
+        const void* found = std::memchr(record, '\n', static_cast<size_t>(end - record));
+        const char* line_end = found ? static_cast<const char*>(found) : end;
+        std::string_view header(record + 1, static_cast<size_t>(line_end - record - 1));
+        if (!header.empty() && header.back() == '\r') {
+            header.remove_suffix(1);
+        }
+        const char* body = line_end < end ? line_end + 1 : end;
+        const char* next = nextHeader(body, end);
+        fn(header, true, body, next);
+        record = next;
+    }
+}
+
+// Call fn(line, length) for each non-empty line of [p, end), without its
+// line ending
+template <typename Fn>
+static void forEachLine(const char* p, const char* end, Fn fn) {
+    while (p < end) {
+        const void* found = std::memchr(p, '\n', static_cast<size_t>(end - p));
+        const char* line_end = found ? static_cast<const char*>(found) : end;
+        size_t length = static_cast<size_t>(line_end - p);
+        if (length > 0 && line_end[-1] == '\r') {
+            length--;
+        }
+        if (length > 0) {
+            fn(p, length);
+        }
+        p = line_end + (line_end < end ? 1 : 0);
+    }
+}
+
+// Pack the sequence lines of a record, sized up front from the record's
+// byte count so the packed words are allocated once
+static void appendRecord(PackedSeq& seq, const char* body, const char* body_end) {
+    seq.reserve(seq.length() + static_cast<size_t>(body_end - body));
+    forEachLine(body, body_end, [&](const char* line, size_t length) {
+        seq.append(line, length);
+    });
+}
 
 // Parse database FASTA file with multiple sequences
-std::vector<Sequence> parseDatabase(const std::string& filename) {
+std::vector<Sequence> parseDatabase(const FastaFile& file) {
     std::vector<Sequence> database;
-    std::ifstream file(filename);
-    
-    if (!file.is_open()) {
-        std::cerr << "Error: Cannot open database file: " << filename << std::endl;
-        return database;
-    }
     
-    std::string line;
-    Sequence current_seq;
-    int seq_index = 0;
-    
-    while (std::getline(file, line)) {
-        // Remove carriage return if present
-        if (!line.empty() && line.back() == '\r') {
-            line.pop_back();
-        }
-        
-        if (line.empty()) continue;
+    forEachRecord(file.data(), file.size(), [&](std::string_view header, bool has_header,
+                            const char* body, const char* body_end) {
+        database.emplace_back();
+        Sequence& current_seq = database.back();
         
-        // Header line starts with '>'
-        if (line[0] == '>') {
-            // Save previous sequence if exists
-            if (!current_seq.seq.empty()) {
-                current_seq.index = seq_index++;
-                database.push_back(current_seq);
-                current_seq = Sequence();
-            }
-            
-            // Parse header: >id|species
-            std::string header = line.substr(1); // Remove '>'
+        // Parse header: >id|species
+        if (has_header) {
             size_t pipe_pos = header.find('|');
-            
-            if (pipe_pos != std::string::npos) {
+            if (pipe_pos != std::string_view::npos) {
                 current_seq.id = header.substr(0, pipe_pos);
                 current_seq.species = header.substr(pipe_pos + 1);
             } else {
@@ -47,115 +155,162 @@ std::vector<Sequence> parseDatabase(const std::string& filename) {
                 current_seq.id = header;
                 current_seq.species = "Unknown";
             }
+        }
+        
+        appendRecord(current_seq.seq, body, body_end);
+        
+        // Records without sequence are dropped
+        if (current_seq.seq.empty()) {
+            database.pop_back();
         } else {
-            // Sequence line - convert to uppercase and append
-            std::string seq_line = line;
-            std::transform(seq_line.begin(), seq_line.end(), seq_line.begin(), ::toupper);
-            current_seq.seq += seq_line;
+            current_seq.index = static_cast<int>(database.size()) - 1;
         }
-    }
-    
-    // Don't forget the last sequence
-    if (!current_seq.seq.empty()) {
-        current_seq.index = seq_index++;
-        database.push_back(current_seq);
-    }
+    });
     
-    file.close();
     return database;
 }
 
 // Parse query FASTA file (single sequence)
 std::string parseQuery(const std::string& filename) {
-    std::ifstream file(filename);
     std::string query;
-    
-    if (!file.is_open()) {
-        std::cerr << "Error: Cannot open query file: " << filename << std::endl;
+    FastaFile file;
+    if (!file.open(filename, "query")) {
         return query;
     }
     
-    std::string line;
-    bool in_sequence = false;
+    forEachRecord(file.data(), file.size(), [&](std::string_view, bool has_header,
+                            const char* body, const char* body_end) {
+        // Lines before the first header are skipped
+        if (!has_header) return;
+        forEachLine(body, body_end, [&](const char* line, size_t length) {
+            size_t start = query.size();
+            query.append(line, length);
+            std::transform(query.begin() + start, query.end(), query.begin() + start, ::toupper);
+        });
+    });
     
-    while (std::getline(file, line)) {
-        // Remove carriage return if present
-        if (!line.empty() && line.back() == '\r') {
-            line.pop_back();
-        }
-        
-        if (line.empty()) continue;
+    return query;
+}
+
+// Append the queries of the records in [data, data + size)
+static void parseQueryRecords(const char* data, size_t size, std::vector<Query>& queries) {
+    forEachRecord(data, size, [&](std::string_view header, bool has_header,
+                                  const char* body, const char* body_end) {
+        queries.emplace_back();
+        Query& current_query = queries.back();
         
-        // Skip header line
-        if (line[0] == '>') {
-            in_sequence = true;
-            continue;
+        // Parse header: >name, dropping any pipe and everything after it
+        if (has_header) {
+            size_t pipe_pos = header.find('|');
+            if (pipe_pos != std::string_view::npos) {
+                current_query.name = header.substr(0, pipe_pos);
+            } else {
+                current_query.name = header.empty() ? std::string_view("Unknown") : header;
+            }
         }
         
-        if (in_sequence) {
-            // Convert to uppercase and append
-            std::string seq_line = line;
-            std::transform(seq_line.begin(), seq_line.end(), seq_line.begin(), ::toupper);
-            query += seq_line;
+        appendRecord(current_query.seq, body, body_end);
+        
+        // Queries without sequence are dropped
+        if (current_query.seq.empty()) {
+            queries.pop_back();
         }
-    }
-    
-    file.close();
-    return query;
+    });
 }
 
 // Parse query FASTA file with multiple sequences
-std::vector<Query> parseQueries(const std::string& filename) {
+std::vector<Query> parseQueries(const FastaFile& file) {
     std::vector<Query> queries;
-    std::ifstream file(filename);
-    
-    if (!file.is_open()) {
+    parseQueryRecords(file.data(), file.size(), queries);
+    return queries;
+}
+
+std::vector<Query> parseQueries(std::string_view text) {
+    std::vector<Query> queries;
+    parseQueryRecords(text.data(), text.size(), queries);
+    return queries;
+}
+
+QueryReader::~QueryReader() {
+    close();
+}
+
+void QueryReader::close() {
+    if (fd_ > STDIN_FILENO) {
+        ::close(fd_);
+    }
+    fd_ = -1;
+    eof_ = false;
+    carry_.clear();
+}
+
+bool QueryReader::open(const std::string& filename, size_t batch_bytes) {
+    close();
+    fd_ = filename == "-" ? STDIN_FILENO : ::open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) {
         std::cerr << "Error: Cannot open query file: " << filename << std::endl;
-        return queries;
+        return false;
     }
-    
-    std::string line;
-    Query current_query;
-    
-    while (std::getline(file, line)) {
-        // Remove carriage return if present
-        if (!line.empty() && line.back() == '\r') {
-            line.pop_back();
-        }
-        
-        if (line.empty()) continue;
+    filename_ = filename;
+    batch_bytes_ = std::max<size_t>(batch_bytes, 1);
+    return true;
+}
+
+// Start of the last record in text that begins at or after from (and
+// after position 0, so the records before it are complete), or 0 if there
+// is none
+static size_t lastRecordStart(const std::vector<char>& text, size_t from) {
+    from = std::max<size_t>(from, 1);
+    size_t end = text.size();
+    while (end > from) {
+        const void* found = memrchr(text.data() + from, '>', end - from);
+        if (found == nullptr) return 0;
+        size_t gt = static_cast<size_t>(static_cast<const char*>(found) - text.data());
+        if (text[gt - 1] == '\n') return gt;
+        end = gt;
+    }
+    return 0;
+}
+
+bool QueryReader::next(QueryBatch& batch) {
+    batch.queries.clear();
+    while (batch.queries.empty() && (!eof_ || !carry_.empty())) {
+        // Start from the partial record left over by the previous batch
+        batch.text.swap(carry_);
+        carry_.clear();
+        batch.text.reserve(batch_bytes_);
         
-        // Header line starts with '>'
-        if (line[0] == '>') {
-            // Save previous query if exists
-            if (!current_query.seq.empty()) {
-                queries.push_back(current_query);
-                current_query = Query();
+        // Fill the batch, then keep reading while it holds no complete record
+        size_t split = 0;
+        size_t searched = 0;
+        while (!eof_) {
+            if (batch.text.size() >= batch_bytes_) {
+                split = lastRecordStart(batch.text, searched);
+                if (split > 0) break;
+                searched = batch.text.size();
             }
-            
-            // Parse header: >name
-            std::string header = line.substr(1); // Remove '>'
-            // Remove any pipe and everything after it
-            size_t pipe_pos = header.find('|');
-            if (pipe_pos != std::string::npos) {
-                current_query.name = header.substr(0, pipe_pos);
-            } else {
-                current_query.name = header.empty() ? "Unknown" : header;
+            size_t used = batch.text.size();
+            size_t chunk = std::max<size_t>(batch_bytes_ - std::min(used, batch_bytes_), 1 << 16);
+            batch.text.resize(used + chunk);
+            ssize_t n = ::read(fd_, batch.text.data() + used, chunk);
+            if (n < 0 && errno == EINTR) {
+                batch.text.resize(used);
+                continue;
             }
-        } else {
-            // Sequence line - convert to uppercase and append
-            std::string seq_line = line;
-            std::transform(seq_line.begin(), seq_line.end(), seq_line.begin(), ::toupper);
-            current_query.seq += seq_line;
+            if (n < 0) {
+                std::cerr << "Error: Cannot read query file: " << filename_ << std::endl;
+            }
+            batch.text.resize(used + static_cast<size_t>(std::max<ssize_t>(n, 0)));
+            eof_ = n <= 0;
         }
+        if (eof_) {
+            split = batch.text.size();
+        }
+        
+        // The records after the split belong to the next batch
+        carry_.assign(batch.text.begin() + static_cast<std::ptrdiff_t>(split), batch.text.end());
+        batch.text.resize(split);
+        parseQueryRecords(batch.text.data(), batch.text.size(), batch.queries);
     }
-    
-    // Don't forget the last query
-    if (!current_query.seq.empty()) {
-        queries.push_back(current_query);
-    }
-    
-    file.close();
-    return queries;
+    return !batch.queries.empty();
 }
-
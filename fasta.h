@@ -2,33 +2,107 @@
 #define FASTA_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include "packed.h"
 
 // Structure to hold a database sequence with its metadata
+// The names are views into the FastaFile the sequence was parsed from
 struct Sequence {
-    std::string id;           // Sequence ID (before |)
-    std::string species;      // Species name (after |)
-    std::string seq;          // DNA sequence
+    std::string_view id;      // Sequence ID (before |)
+    std::string_view species; // Species name (after |)
+    PackedSeq seq;            // DNA sequence, 2-bit packed
     int index;                // Index in database vector
+    std::vector<MaskInterval> mask;  // Low-complexity intervals, not indexed
 };
 
 // Structure to hold a query sequence with its name
 struct Query {
-    std::string name;         // Query name (from header)
-    std::string seq;          // DNA sequence
+    std::string_view name;    // Query name (from header), a view into the FastaFile
+    PackedSeq seq;            // DNA sequence, 2-bit packed
+};
+
+// Read-only contents of a FASTA file. Regular files are memory-mapped;
+// anything else (a pipe, a terminal) is read into memory. Records parsed
+// from the file keep their names as views into it, so it must outlive them.
+class FastaFile {
+public:
+    FastaFile() = default;
+    ~FastaFile();
+    FastaFile(const FastaFile&) = delete;
+    FastaFile& operator=(const FastaFile&) = delete;
+
+    // Open a file; kind names it in error messages ("database", "query")
+    // Returns false (after reporting the reason) on error
+    bool open(const std::string& filename, const char* kind);
+    void close();
+    bool isOpen() const { return open_; }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool open_ = false;
+    bool mapped_ = false;
+    std::string buffer_;      // Contents of a file that could not be mapped
 };
 
 // Parse database FASTA file with multiple sequences
 // Format: >id|species\nsequence
-std::vector<Sequence> parseDatabase(const std::string& filename);
+std::vector<Sequence> parseDatabase(const FastaFile& file);
 
 // Parse query FASTA file (single sequence)
 // Returns the DNA sequence string
 std::string parseQuery(const std::string& filename);
 
 // Parse query FASTA file with multiple sequences
-// Returns vector of Query structures
-std::vector<Query> parseQueries(const std::string& filename);
+// Returns vector of Query structures; records without sequence are dropped,
+// so every query has at least one base
+std::vector<Query> parseQueries(const FastaFile& file);
 
-#endif // FASTA_H
+// Same, from FASTA text in memory; the names are views into text
+std::vector<Query> parseQueries(std::string_view text);
+
+// Queries parsed from one batch of a query file; the names are views
+// into text, which holds the batch's FASTA records
+struct QueryBatch {
+    std::vector<char> text;
+    std::vector<Query> queries;
+};
 
+// Reads a query file, or standard input for "-", in batches of whole
+// records, so queries can be searched before the rest of the input is
+// read and memory stays bounded however many queries there are. Each
+// batch holds about batch_bytes of FASTA text; a single record longer than
+// that is read in full into a batch of its own.
+class QueryReader {
+public:
+    QueryReader() = default;
+    ~QueryReader();
+    QueryReader(const QueryReader&) = delete;
+    QueryReader& operator=(const QueryReader&) = delete;
+
+    // Returns false (after reporting the reason) on error
+    bool open(const std::string& filename, size_t batch_bytes);
+    void close();
+
+    // Replace the contents of batch with the next queries; returns false
+    // once the input is exhausted. A read error is reported and ends the
+    // input.
+    bool next(QueryBatch& batch);
+
+    // Whether every query has been read, so the last batch returned is
+    // the last one
+    bool exhausted() const { return eof_ && carry_.empty(); }
+
+private:
+    int fd_ = -1;
+    bool eof_ = false;
+    size_t batch_bytes_ = 0;
+    std::string filename_;
+    std::vector<char> carry_;     // Start of a record that continues in the next read
+};
+
+#endif // FASTA_H
@@ -0,0 +1,518 @@
+#include "gapped.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GAPPED_X86 1
+#endif
+
+// Match and mismatch scores, as in the ungapped stage
+static const int MATCH = 2;
+static const int MISMATCH = -1;
+
+// Score of a cell that is outside the band or has been pruned. Far enough
+// from INT32_MIN that subtracting gap costs from it never wraps.
+static const int32_t NEG_INF = -(1 << 28);
+
+// Trace byte of a cell: how H was reached (bits 0-1), and whether E and F
+// continued an open gap rather than opening a new one
+static const uint8_t TRACE_DIAG = 0;
+static const uint8_t TRACE_E = 1;         // Gap in the database (query base, CIGAR I)
+static const uint8_t TRACE_F = 2;         // Gap in the query (database base, CIGAR D)
+static const uint8_t TRACE_E_EXTEND = 4;
+static const uint8_t TRACE_F_EXTEND = 8;
+
+// Base codes; the two sides use different codes for ambiguous bases and
+// for the sentinels so none of them ever match
+static const uint8_t DB_AMBIGUOUS = 4;
+static const uint8_t QUERY_AMBIGUOUS = 5;
+static const uint8_t DB_SENTINEL = 6;
+static const uint8_t QUERY_SENTINEL = 7;
+
+// Buffers reused by every extension on a thread
+struct GappedWorkspace {
+    std::vector<uint8_t> db;            // db[i] pairs with DP row i (db[0] is a sentinel)
+    std::vector<uint8_t> query_rev;     // Query bases of one side, reversed, then a sentinel
+    std::vector<int32_t> h[3];          // H of anti-diagonals t - 2, t - 1 and t, by t % 3
+    std::vector<int32_t> e[2];          // E of anti-diagonals by t % 2
+    std::vector<int32_t> f[2];          // F of anti-diagonals by t % 2
+    std::vector<uint8_t> trace;         // Trace bytes of every computed cell
+    std::vector<size_t> trace_offset;   // Start of anti-diagonal t in trace
+    std::vector<int> trace_lo;          // First row stored for anti-diagonal t
+    std::string ops;                    // One CIGAR letter per column
+};
+
+// Best cell of a one-sided extension: i database and j query bases past
+// the anchor
+struct SideBest {
+    int score;
+    int i;
+    int j;
+};
+
+// Everything one anti-diagonal step needs, with the arrays offset so that
+// row i is index i (row -1 is the boundary column)
+struct DiagonalStep {
+    const int32_t* h2;       // H of anti-diagonal t - 2
+    const int32_t* h1;       // H of anti-diagonal t - 1
+    const int32_t* e1;
+    const int32_t* f1;
+    int32_t* h0;
+    int32_t* e0;
+    int32_t* f0;
+    const uint8_t* db;       // Database base of row i
+    const uint8_t* query;    // Query base of row i on this anti-diagonal
+    uint8_t* trace;          // Trace byte of row i
+    int32_t open_extend;     // Cost of the first base of a gap
+    int32_t extend;          // Cost of every further base
+    int32_t threshold;       // Cells scoring below this are pruned
+};
+
+// One cell of the affine-gap recurrence
+//   E(i, j) = max(H(i, j - 1) - open_extend, E(i, j - 1) - extend)
+//   F(i, j) = max(H(i - 1, j) - open_extend, F(i - 1, j) - extend)
+//   H(i, j) = max(H(i - 1, j - 1) + s(i, j), E(i, j), F(i, j))
+// On anti-diagonal t = i + j the left neighbour (i, j - 1) is row i and the
+// upper one (i - 1, j) row i - 1 of t - 1; the diagonal one is row i - 1
+// of t - 2. The SIMD steps below compute exactly this, several rows at once.
+struct ScalarCells {
+    static const int LANES = 1;
+
+    static inline void cell(const DiagonalStep& s, int i, int32_t& best) {
+        int32_t hd = s.h2[i - 1] + (s.db[i] == s.query[i] ? MATCH : MISMATCH);
+        int32_t e_open = s.h1[i] - s.open_extend;
+        int32_t e_ext = s.e1[i] - s.extend;
+        int32_t f_open = s.h1[i - 1] - s.open_extend;
+        int32_t f_ext = s.f1[i - 1] - s.extend;
+        int32_t e = std::max(e_open, e_ext);
+        int32_t f = std::max(f_open, f_ext);
+        int32_t h = std::max(hd, std::max(e, f));
+        s.trace[i] = static_cast<uint8_t>(
+            (h == hd ? TRACE_DIAG : h == e ? TRACE_E : TRACE_F) |
+            (e_ext > e_open ? TRACE_E_EXTEND : 0) |
+            (f_ext > f_open ? TRACE_F_EXTEND : 0));
+        if (h < s.threshold) {
+            h = e = f = NEG_INF;
+        }
+        s.h0[i] = h;
+        s.e0[i] = e;
+        s.f0[i] = f;
+        best = std::max(best, h);
+    }
+
+    // Rows [lo, hi]; returns the best H
+    static inline int32_t run(const DiagonalStep& s, int lo, int hi) {
+        int32_t best = NEG_INF;
+        for (int i = lo; i <= hi; ++i) {
+            cell(s, i, best);
+        }
+        return best;
+    }
+};
+
+#ifdef GAPPED_X86
+struct Sse42Cells {
+    static const int LANES = 4;
+
+    __attribute__((target("sse4.2")))
+    static inline __m128i load(const int32_t* p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+
+    __attribute__((target("sse4.2")))
+    static inline __m128i codes(const uint8_t* p) {
+        int32_t bytes;
+        std::memcpy(&bytes, p, sizeof(bytes));
+        return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+    }
+
+    __attribute__((target("sse4.2")))
+    static inline int32_t run(const DiagonalStep& s, int lo, int hi) {
+        const __m128i match = _mm_set1_epi32(MATCH);
+        const __m128i mismatch = _mm_set1_epi32(MISMATCH);
+        const __m128i open_extend = _mm_set1_epi32(s.open_extend);
+        const __m128i extend = _mm_set1_epi32(s.extend);
+        const __m128i threshold = _mm_set1_epi32(s.threshold);
+        const __m128i neg_inf = _mm_set1_epi32(NEG_INF);
+        const __m128i from_e = _mm_set1_epi32(TRACE_E);
+        const __m128i from_f = _mm_set1_epi32(TRACE_F);
+        const __m128i e_extend = _mm_set1_epi32(TRACE_E_EXTEND);
+        const __m128i f_extend = _mm_set1_epi32(TRACE_F_EXTEND);
+        const __m128i low_bytes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+                                                -1, -1, -1, -1, -1, -1, -1, -1);
+        __m128i best = neg_inf;
+
+        int i = lo;
+        for (; i + LANES - 1 <= hi; i += LANES) {
+            __m128i same = _mm_cmpeq_epi32(codes(s.db + i), codes(s.query + i));
+            __m128i hd = _mm_add_epi32(load(s.h2 + i - 1),
+                                       _mm_blendv_epi8(mismatch, match, same));
+            __m128i e_open = _mm_sub_epi32(load(s.h1 + i), open_extend);
+            __m128i e_ext = _mm_sub_epi32(load(s.e1 + i), extend);
+            __m128i f_open = _mm_sub_epi32(load(s.h1 + i - 1), open_extend);
+            __m128i f_ext = _mm_sub_epi32(load(s.f1 + i - 1), extend);
+            __m128i e = _mm_max_epi32(e_open, e_ext);
+            __m128i f = _mm_max_epi32(f_open, f_ext);
+            __m128i h = _mm_max_epi32(hd, _mm_max_epi32(e, f));
+
+            __m128i source = _mm_blendv_epi8(from_f, from_e, _mm_cmpeq_epi32(h, e));
+            source = _mm_andnot_si128(_mm_cmpeq_epi32(h, hd), source);
+            source = _mm_or_si128(source, _mm_and_si128(_mm_cmpgt_epi32(e_ext, e_open), e_extend));
+            source = _mm_or_si128(source, _mm_and_si128(_mm_cmpgt_epi32(f_ext, f_open), f_extend));
+            int32_t trace = _mm_cvtsi128_si32(_mm_shuffle_epi8(source, low_bytes));
+            std::memcpy(s.trace + i, &trace, sizeof(trace));
+
+            __m128i pruned = _mm_cmpgt_epi32(threshold, h);
+            h = _mm_blendv_epi8(h, neg_inf, pruned);
+            e = _mm_blendv_epi8(e, neg_inf, pruned);
+            f = _mm_blendv_epi8(f, neg_inf, pruned);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(s.h0 + i), h);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(s.e0 + i), e);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(s.f0 + i), f);
+            best = _mm_max_epi32(best, h);
+        }
+
+        best = _mm_max_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+        best = _mm_max_epi32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+        int32_t result = _mm_cvtsi128_si32(best);
+        for (; i <= hi; ++i) {
+            ScalarCells::cell(s, i, result);
+        }
+        return result;
+    }
+};
+
+struct Avx2Cells {
+    static const int LANES = 8;
+
+    __attribute__((target("avx2")))
+    static inline __m256i load(const int32_t* p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+
+    __attribute__((target("avx2")))
+    static inline __m256i codes(const uint8_t* p) {
+        return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    }
+
+    __attribute__((target("avx2")))
+    static inline int32_t run(const DiagonalStep& s, int lo, int hi) {
+        const __m256i match = _mm256_set1_epi32(MATCH);
+        const __m256i mismatch = _mm256_set1_epi32(MISMATCH);
+        const __m256i open_extend = _mm256_set1_epi32(s.open_extend);
+        const __m256i extend = _mm256_set1_epi32(s.extend);
+        const __m256i threshold = _mm256_set1_epi32(s.threshold);
+        const __m256i neg_inf = _mm256_set1_epi32(NEG_INF);
+        const __m256i from_e = _mm256_set1_epi32(TRACE_E);
+        const __m256i from_f = _mm256_set1_epi32(TRACE_F);
+        const __m256i e_extend = _mm256_set1_epi32(TRACE_E_EXTEND);
+        const __m256i f_extend = _mm256_set1_epi32(TRACE_F_EXTEND);
+        // Low byte of each lane to the bottom of its 128-bit half, then the
+        // two halves' first dwords together
+        const __m256i low_bytes = _mm256_setr_epi8(
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m256i halves = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+        __m256i best = neg_inf;
+
+        int i = lo;
+        for (; i + LANES - 1 <= hi; i += LANES) {
+            __m256i same = _mm256_cmpeq_epi32(codes(s.db + i), codes(s.query + i));
+            __m256i hd = _mm256_add_epi32(load(s.h2 + i - 1),
+                                          _mm256_blendv_epi8(mismatch, match, same));
+            __m256i e_open = _mm256_sub_epi32(load(s.h1 + i), open_extend);
+            __m256i e_ext = _mm256_sub_epi32(load(s.e1 + i), extend);
+            __m256i f_open = _mm256_sub_epi32(load(s.h1 + i - 1), open_extend);
+            __m256i f_ext = _mm256_sub_epi32(load(s.f1 + i - 1), extend);
+            __m256i e = _mm256_max_epi32(e_open, e_ext);
+            __m256i f = _mm256_max_epi32(f_open, f_ext);
+            __m256i h = _mm256_max_epi32(hd, _mm256_max_epi32(e, f));
+
+            __m256i source = _mm256_blendv_epi8(from_f, from_e, _mm256_cmpeq_epi32(h, e));
+            source = _mm256_andnot_si256(_mm256_cmpeq_epi32(h, hd), source);
+            source = _mm256_or_si256(source,
+                _mm256_and_si256(_mm256_cmpgt_epi32(e_ext, e_open), e_extend));
+            source = _mm256_or_si256(source,
+                _mm256_and_si256(_mm256_cmpgt_epi32(f_ext, f_open), f_extend));
+            __m256i packed = _mm256_permutevar8x32_epi32(
+                _mm256_shuffle_epi8(source, low_bytes), halves);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(s.trace + i),
+                             _mm256_castsi256_si128(packed));
+
+            __m256i pruned = _mm256_cmpgt_epi32(threshold, h);
+            h = _mm256_blendv_epi8(h, neg_inf, pruned);
+            e = _mm256_blendv_epi8(e, neg_inf, pruned);
+            f = _mm256_blendv_epi8(f, neg_inf, pruned);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(s.h0 + i), h);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(s.e0 + i), e);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(s.f0 + i), f);
+            best = _mm256_max_epi32(best, h);
+        }
+
+        __m128i half = _mm_max_epi32(_mm256_castsi256_si128(best),
+                                     _mm256_extracti128_si256(best, 1));
+        half = _mm_max_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+        half = _mm_max_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+        int32_t result = _mm_cvtsi128_si32(half);
+        for (; i <= hi; ++i) {
+            ScalarCells::cell(s, i, result);
+        }
+        return result;
+    }
+};
+#endif
+
+// X-drop dynamic program for one side of the anchor. Row i consumes i
+// database bases (ws.db[1..]), column j consumes j query bases; the query
+// is stored reversed so that the bases paired along an anti-diagonal are
+// consecutive in memory, like the database bases.
+// Keeps the trace of every computed cell for the traceback.
+template <typename Cells>
+static inline SideBest alignSide(GappedWorkspace& ws, int rows, int cols,
+                                 const GappedOptions& options) {
+    const int band = options.band;
+    // Rows -1 to rows + 1, so the cells around the live range always exist
+    for (auto& v : ws.h) v.assign(rows + 3, NEG_INF);
+    for (auto& v : ws.e) v.assign(rows + 3, NEG_INF);
+    for (auto& v : ws.f) v.assign(rows + 3, NEG_INF);
+    ws.trace.clear();
+    ws.trace_offset.clear();
+    ws.trace_lo.clear();
+
+    // Anti-diagonal 0 is the anchor itself
+    ws.h[0][1] = 0;
+    ws.trace.push_back(TRACE_DIAG);
+    ws.trace_offset.push_back(0);
+    ws.trace_lo.push_back(0);
+
+    SideBest best = {0, 0, 0};
+    int lo = 0, hi = 0;
+    for (int t = 1; t <= rows + cols; ++t) {
+        // Rows of this anti-diagonal inside the band and both sequences
+        // whose neighbours on the previous one are still alive
+        lo = std::max({lo, (t - band + 1) >> 1, t - cols});
+        hi = std::min({hi + 1, (t + band) >> 1, rows, t});
+        if (lo > hi) break;
+
+        DiagonalStep step;
+        step.h2 = ws.h[(t + 1) % 3].data() + 1;
+        step.h1 = ws.h[(t + 2) % 3].data() + 1;
+        step.h0 = ws.h[t % 3].data() + 1;
+        step.e1 = ws.e[(t + 1) & 1].data() + 1;
+        step.e0 = ws.e[t & 1].data() + 1;
+        step.f1 = ws.f[(t + 1) & 1].data() + 1;
+        step.f0 = ws.f[t & 1].data() + 1;
+        step.db = ws.db.data();
+        step.query = ws.query_rev.data() + (cols - t);
+        size_t offset = ws.trace.size();
+        ws.trace.resize(offset + (hi - lo + 1));
+        step.trace = ws.trace.data() + offset - lo;
+        step.open_extend = options.gap_open + options.gap_extend;
+        step.extend = options.gap_extend;
+        step.threshold = best.score - options.x_drop;
+        ws.trace_offset.push_back(offset);
+        ws.trace_lo.push_back(lo);
+
+        int32_t diagonal_best = Cells::run(step, lo, hi);
+        if (diagonal_best > best.score) {
+            int i = lo;
+            while (step.h0[i] != diagonal_best) ++i;
+            best = SideBest{diagonal_best, i, t - i};
+        }
+
+        // Drop pruned cells from both ends; the cells just outside the live
+        // range must read as pruned for the next two anti-diagonals
+        while (lo <= hi && step.h0[lo] == NEG_INF) ++lo;
+        while (hi >= lo && step.h0[hi] == NEG_INF) --hi;
+        if (lo > hi) break;
+        step.h0[lo - 1] = step.e0[lo - 1] = step.f0[lo - 1] = NEG_INF;
+        step.h0[hi + 1] = step.e0[hi + 1] = step.f0[hi + 1] = NEG_INF;
+    }
+    return best;
+}
+
+// Walk the trace back from a side's best cell to the anchor, appending one
+// CIGAR letter per column in order of decreasing distance from the anchor
+static void traceback(const GappedWorkspace& ws, SideBest best, std::string& ops) {
+    int i = best.i, j = best.j;
+    uint8_t state = TRACE_DIAG;
+    while (i > 0 || j > 0) {
+        int t = i + j;
+        uint8_t trace = ws.trace[ws.trace_offset[t] + (i - ws.trace_lo[t])];
+        if (state == TRACE_DIAG) {
+            state = trace & 3;
+            if (state == TRACE_DIAG) {
+                ops.push_back('M');
+                --i;
+                --j;
+            }
+        } else if (state == TRACE_E) {
+            ops.push_back('I');
+            if (!(trace & TRACE_E_EXTEND)) state = TRACE_DIAG;
+            --j;
+        } else {
+            ops.push_back('D');
+            if (!(trace & TRACE_F_EXTEND)) state = TRACE_DIAG;
+            --i;
+        }
+    }
+}
+
+static inline uint8_t baseCode(char c, uint8_t ambiguous) {
+    switch (c) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return ambiguous;
+    }
+}
+
+// Decode bases [pos, pos + len) into codes, optionally reversed
+static void decodeBases(const PackedView& seq, size_t pos, size_t len, bool reverse,
+                        uint8_t ambiguous, uint8_t* out) {
+    std::string letters = seq.substr(pos, len);
+    for (size_t p = 0; p < len; ++p) {
+        out[p] = baseCode(letters[reverse ? len - 1 - p : p], ambiguous);
+    }
+}
+
+using SideFunction = SideBest (*)(GappedWorkspace&, int, int, const GappedOptions&);
+
+__attribute__((flatten))
+static SideBest alignSideScalar(GappedWorkspace& ws, int rows, int cols,
+                                const GappedOptions& options) {
+    return alignSide<ScalarCells>(ws, rows, cols, options);
+}
+
+#ifdef GAPPED_X86
+__attribute__((target("sse4.2"), flatten))
+static SideBest alignSideSse42(GappedWorkspace& ws, int rows, int cols,
+                               const GappedOptions& options) {
+    return alignSide<Sse42Cells>(ws, rows, cols, options);
+}
+
+__attribute__((target("avx2"), flatten))
+static SideBest alignSideAvx2(GappedWorkspace& ws, int rows, int cols,
+                              const GappedOptions& options) {
+    return alignSide<Avx2Cells>(ws, rows, cols, options);
+}
+#endif
+
+static SideFunction sideFunction(ExtensionKernel kernel) {
+    if (kernel == ExtensionKernel::Auto) {
+        kernel = bestExtensionKernel();
+    }
+#ifdef GAPPED_X86
+    if (kernel == ExtensionKernel::Avx2) return alignSideAvx2;
+    if (kernel == ExtensionKernel::Sse42) return alignSideSse42;
+#endif
+    return alignSideScalar;
+}
+
+// Align both sides of the anchor and join them into one alignment
+static GappedResult extendWith(SideFunction align_side,
+                               const PackedView& db_seq, const PackedView& query,
+                               int db_anchor, int q_anchor,
+                               const GappedOptions& options) {
+    thread_local GappedWorkspace ws;
+    const int band = std::max(options.band, 0);
+    ws.ops.clear();
+
+    // Left side: rows walk left from db_anchor - 1, columns from q_anchor - 1
+    int rows = std::min(db_anchor, q_anchor + band);
+    int cols = std::min(q_anchor, db_anchor + band);
+    ws.db.resize(rows + 1);
+    ws.query_rev.resize(cols + 1);
+    ws.db[0] = DB_SENTINEL;
+    decodeBases(db_seq, db_anchor - rows, rows, true, DB_AMBIGUOUS, ws.db.data() + 1);
+    decodeBases(query, q_anchor - cols, cols, false, QUERY_AMBIGUOUS, ws.query_rev.data());
+    ws.query_rev[cols] = QUERY_SENTINEL;
+    SideBest left = align_side(ws, rows, cols, options);
+    traceback(ws, left, ws.ops);
+
+    // The anchor pair itself
+    char db_base = db_seq.at(db_anchor);
+    char q_base = query.at(q_anchor);
+    bool anchor_match = baseCode(db_base, DB_AMBIGUOUS) == baseCode(q_base, QUERY_AMBIGUOUS);
+    ws.ops.push_back('M');
+    size_t left_ops = ws.ops.size();
+
+    // Right side: rows walk right from db_anchor + 1, columns from q_anchor + 1
+    int db_rest = static_cast<int>(db_seq.size()) - db_anchor - 1;
+    int q_rest = static_cast<int>(query.size()) - q_anchor - 1;
+    rows = std::min(db_rest, q_rest + band);
+    cols = std::min(q_rest, db_rest + band);
+    ws.db.resize(rows + 1);
+    ws.query_rev.resize(cols + 1);
+    ws.db[0] = DB_SENTINEL;
+    decodeBases(db_seq, db_anchor + 1, rows, false, DB_AMBIGUOUS, ws.db.data() + 1);
+    decodeBases(query, q_anchor + 1, cols, true, QUERY_AMBIGUOUS, ws.query_rev.data());
+    ws.query_rev[cols] = QUERY_SENTINEL;
+    SideBest right = align_side(ws, rows, cols, options);
+    traceback(ws, right, ws.ops);
+    std::reverse(ws.ops.begin() + left_ops, ws.ops.end());
+
+    GappedResult result;
+    result.db_start = db_anchor - left.i;
+    result.db_end = db_anchor + right.i;
+    result.q_start = q_anchor - left.j;
+    result.q_end = q_anchor + right.j;
+    result.score = left.score + right.score + (anchor_match ? MATCH : MISMATCH);
+
+    // Identity over the alignment columns, and the run-length CIGAR
+    std::string db_letters = db_seq.substr(result.db_start, result.db_end - result.db_start + 1);
+    std::string q_letters = query.substr(result.q_start, result.q_end - result.q_start + 1);
+    size_t db_pos = 0, q_pos = 0, matches = 0, run = 0;
+    for (size_t c = 0; c < ws.ops.size(); ++c) {
+        char op = ws.ops[c];
+        ++run;
+        if (op == 'M') {
+            if (baseCode(db_letters[db_pos], DB_AMBIGUOUS) ==
+                baseCode(q_letters[q_pos], QUERY_AMBIGUOUS)) {
+                ++matches;
+            }
+            ++db_pos;
+            ++q_pos;
+        } else if (op == 'I') {
+            ++q_pos;
+        } else {
+            ++db_pos;
+        }
+        if (c + 1 == ws.ops.size() || ws.ops[c + 1] != op) {
+            result.cigar += std::to_string(run);
+            result.cigar += op;
+            run = 0;
+        }
+    }
+    result.identity = (100.0 * matches) / ws.ops.size();
+    return result;
+}
+
+// Banded affine-gap X-drop alignment through an anchor pair of bases,
+// using the widest kernel the CPU supports, chosen once on first use
+GappedResult extendGapped(
+    const PackedView& db_seq,
+    const PackedView& query,
+    int db_anchor,
+    int q_anchor,
+    const GappedOptions& options
+) {
+    static const SideFunction align_side = sideFunction(ExtensionKernel::Auto);
+    return extendWith(align_side, db_seq, query, db_anchor, q_anchor, options);
+}
+
+// Gapped extension with a specific kernel (for benchmarks)
+GappedResult extendGappedWith(
+    ExtensionKernel kernel,
+    const PackedView& db_seq,
+    const PackedView& query,
+    int db_anchor,
+    int q_anchor,
+    const GappedOptions& options
+) {
+    return extendWith(sideFunction(kernel), db_seq, query, db_anchor, q_anchor, options);
+}
@@ -0,0 +1,57 @@
+#ifndef GAPPED_H
+#define GAPPED_H
+
+#include <string>
+#include "packed.h"
+#include "scoring.h"
+
+// Gapped extension parameters. Scores use the ungapped stage's +2/-1, and
+// a gap of length L costs gap_open + L * gap_extend. With +2/-1 the gap
+// costs must be higher than BLASTN's 5/2: below about 8/3, alignments of
+// unrelated sequence keep gaining score and run to the end of the band.
+struct GappedOptions {
+    int gap_open = 8;
+    int gap_extend = 3;
+    int band = 64;        // Largest shift |i - j| away from the anchor diagonal
+    int x_drop = 30;      // Score drop below the best at which cells are pruned
+    int trigger = 30;     // Ungapped score an HSP needs to be re-aligned with gaps
+};
+
+// Gapped alignment result
+struct GappedResult {
+    int db_start;      // Start position in database sequence
+    int db_end;        // End position in database sequence
+    int q_start;       // Start position in query sequence
+    int q_end;         // End position in query sequence
+    int score;         // Alignment score
+    double identity;   // Matching columns over all columns, gaps included (0-100)
+    std::string cigar; // Alignment operations, M/I/D with the database as reference
+};
+
+// Banded affine-gap X-drop alignment through an anchor pair of bases.
+// The anchor is aligned to itself, and a dynamic program extends from it
+// to the right and to the left, keeping only cells within options.band of
+// the anchor diagonal whose score is within options.x_drop of the best.
+// Cells are computed one anti-diagonal at a time, which has no dependency
+// between cells of the same anti-diagonal, so the widest SIMD kernel the
+// CPU supports handles several of them per step.
+GappedResult extendGapped(
+    const PackedView& db_seq,
+    const PackedView& query,
+    int db_anchor,
+    int q_anchor,
+    const GappedOptions& options
+);
+
+// Gapped extension with a specific kernel (for benchmarks)
+// The kernel must be supported, see extensionKernelSupported
+GappedResult extendGappedWith(
+    ExtensionKernel kernel,
+    const PackedView& db_seq,
+    const PackedView& query,
+    int db_anchor,
+    int q_anchor,
+    const GappedOptions& options
+);
+
+#endif // GAPPED_H
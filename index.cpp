@@ -1,11 +1,18 @@
 #include "index.h"
+#include "parallel.h"
+#include "dust.h"
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
 
 // Encode a k-mer string to integer using 2-bit encoding
 // Each nucleotide takes 2 bits: A=00, C=01, G=10, T=11
-// This allows k up to 16 (32 bits / 2 bits per nucleotide)
-uint32_t encodeKmer(const std::string& kmer) {
-    uint32_t encoded = 0;
+// This allows k up to 32 (64 bits / 2 bits per nucleotide)
+KmerKey encodeKmer(const std::string& kmer) {
+    KmerKey encoded = 0;
     
     for (char c : kmer) {
         encoded <<= 2;  // Shift left by 2 bits
@@ -32,53 +39,559 @@ uint32_t encodeKmer(const std::string& kmer) {
     return encoded;
 }
 
-// Extract k-mer at position i from sequence using rolling hash
-// This function encodes the k-mer starting at position pos
-uint32_t getKmerAt(const std::string& seq, int pos, int k) {
-    if (pos + k > static_cast<int>(seq.length())) {
-        return 0;  // Invalid position
+// Extract k-mer at position pos from a packed sequence into *key
+// The packed words already hold 2-bit codes in encodeKmer order, so the
+// k-mer is the top 2k bits of the 32-base window starting at pos
+bool getKmerAt(const PackedView& seq, int pos, int k, KmerKey* key) {
+    if (pos < 0 || k < 1 || k > 32 || pos + k > static_cast<int>(seq.size())) {
+        return false;  // Invalid position
     }
     
-    std::string kmer = seq.substr(pos, k);
-    return encodeKmer(kmer);
+    uint64_t kmer_bits = k == 32 ? ~static_cast<uint64_t>(0)
+                                 : ~(~static_cast<uint64_t>(0) >> (2 * k));
+    if ((seq.ambiguityMask(pos) & kmer_bits) != 0) {
+        return false;  // Contains N or another ambiguous base
+    }
+    
+    *key = k == 32 ? seq.window(pos) : seq.window(pos) >> (64 - 2 * k);
+    return true;
+}
+
+// Bytes needed by the direct offsets table for k
+// (saturates for k far beyond MAX_DIRECT_K, where the table cannot exist)
+size_t directTableBytes(int k) {
+    if (k > 28) return SIZE_MAX;
+    return ((static_cast<size_t>(1) << (2 * k)) + 1) * sizeof(uint64_t);
+}
+
+KmerIndex KmerIndex::view(const SeedShape& shape,
+                          const KmerKey* keys, size_t num_keys,
+                          const uint64_t* offsets,
+                          const Posting* postings, size_t num_postings,
+                          const IndexFilterStats& filter, int window,
+                          const uint8_t* blocks, size_t block_bytes) {
+    KmerIndex index;
+    index.shape_ = shape;
+    index.window_ = window;
+    index.keys_ = keys;
+    index.num_keys_ = num_keys;
+    index.offsets_ = offsets;
+    index.postings_ = postings;
+    index.num_postings_ = num_postings;
+    index.blocks_ = blocks;
+    index.block_bytes_ = block_bytes;
+    index.filter_ = filter;
+    index.setHashShift();
+    return index;
+}
+
+// Multiplicative hashing keeps the top log2(num_keys_) bits of the product
+void KmerIndex::setHashShift() {
+    hash_shift_ = 64;
+    for (size_t size = num_keys_; size > 1; size >>= 1) {
+        hash_shift_--;
+    }
+}
+
+size_t KmerIndex::numOffsets() const {
+    if (shape_.weight() == 0) return 0;
+    return (isDirect() ? (static_cast<size_t>(1) << (2 * k())) : num_keys_) + 1;
+}
+
+size_t KmerIndex::memoryBytes() const {
+    return num_keys_ * sizeof(KmerKey) + numOffsets() * sizeof(uint64_t) +
+           (isCompressed() ? block_bytes_ : num_postings_ * sizeof(Posting));
+}
+
+static void appendVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Append values packed at width bits each, least significant bit first
+static void appendPacked(std::vector<uint8_t>& out, const uint32_t* values, size_t count,
+                         unsigned width) {
+    uint64_t buffer = 0;
+    unsigned filled = 0;
+    for (size_t i = 0; i < count; ++i) {
+        buffer |= static_cast<uint64_t>(values[i]) << filled;
+        filled += width;
+        while (filled >= 8) {
+            out.push_back(static_cast<uint8_t>(buffer));
+            buffer >>= 8;
+            filled -= 8;
+        }
+    }
+    if (filled > 0) {
+        out.push_back(static_cast<uint8_t>(buffer));
+    }
+}
+
+static unsigned bitWidth(uint32_t value) {
+    return value == 0 ? 0 : 32 - static_cast<unsigned>(__builtin_clz(value));
+}
+
+// Encode the postings of one k-mer as PostingDecoder reads them
+static void encodePostings(const Posting* first, const Posting* last,
+                           std::vector<uint8_t>& out) {
+    out.clear();
+    if (first == last) return;
+    appendVarint(out, static_cast<uint64_t>(last - first));
+    uint32_t seq_deltas[POSTING_BLOCK];
+    uint32_t positions[POSTING_BLOCK];
+    for (const Posting* block = first; block < last; block += POSTING_BLOCK) {
+        size_t n = std::min<size_t>(static_cast<size_t>(last - block), POSTING_BLOCK);
+        appendVarint(out, static_cast<uint32_t>(postingSeq(block[0])));
+        appendVarint(out, static_cast<uint32_t>(postingPos(block[0])));
+        if (n == 1) continue;
+        uint32_t max_delta = 0, max_position = 0;
+        for (size_t i = 1; i < n; ++i) {
+            uint32_t delta = static_cast<uint32_t>(postingSeq(block[i]) - postingSeq(block[i - 1]));
+            uint32_t pos = static_cast<uint32_t>(postingPos(block[i]));
+            seq_deltas[i - 1] = delta;
+            positions[i - 1] = delta == 0 ? pos - static_cast<uint32_t>(postingPos(block[i - 1]))
+                                          : pos;
+            max_delta = std::max(max_delta, delta);
+            max_position = std::max(max_position, positions[i - 1]);
+        }
+        unsigned seq_width = bitWidth(max_delta);
+        unsigned pos_width = bitWidth(max_position);
+        out.push_back(static_cast<uint8_t>(seq_width));
+        out.push_back(static_cast<uint8_t>(pos_width));
+        appendPacked(out, seq_deltas, n - 1, seq_width);
+        appendPacked(out, positions, n - 1, pos_width);
+    }
+}
+
+// Start of one build shard: k-mers from base pos of sequence sid onwards
+struct ShardStart {
+    size_t sid;
+    size_t pos;
+};
+
+// Cut the database into `shards` runs of roughly equal length. Shard s
+// covers the k-mer start positions from cuts[s] up to cuts[s + 1], so the
+// shards visit postings in exactly the order of a serial walk.
+static std::vector<ShardStart> shardDatabase(const std::vector<Sequence>& database,
+                                             size_t shards) {
+    size_t total = 0;
+    for (const auto& seq : database) {
+        total += seq.seq.length();
+    }
+    
+    std::vector<ShardStart> cuts;
+    cuts.push_back(ShardStart{0, 0});
+    size_t sid = 0;
+    size_t before = 0;  // Bases in sequences before sid
+    for (size_t s = 1; s < shards; ++s) {
+        size_t target = total / shards * s + total % shards * s / shards;
+        while (sid < database.size() && before + database[sid].seq.length() <= target) {
+            before += database[sid].seq.length();
+            ++sid;
+        }
+        cuts.push_back(ShardStart{sid, sid < database.size() ? target - before : 0});
+    }
+    cuts.push_back(ShardStart{database.size(), 0});
+    return cuts;
+}
+
+// Call visit(sequence index, position, key) for every valid seed of shard
+// s, or with window > 1 for every minimizer. Returns the number of valid
+// seeds in the shard.
+template <typename Visit>
+static uint64_t forEachShardKmer(const std::vector<Sequence>& database,
+                                 const std::vector<ShardStart>& cuts, size_t s,
+                                 const SeedShape& shape, int window, Visit visit) {
+    const ShardStart& first = cuts[s];
+    const ShardStart& last = cuts[s + 1];
+    uint64_t seeds = 0;
+    withSeedEncoder(shape, [&](const auto& encoder) {
+        for (size_t sid = first.sid; sid <= last.sid && sid < database.size(); ++sid) {
+            const Sequence& seq = database[sid];
+            size_t begin = sid == first.sid ? first.pos : 0;
+            size_t end = sid == last.sid ? last.pos : seq.seq.length();
+            if (window > 1) {
+                // Minimizers are gathered a block at a time, so the visits'
+                // table accesses are not held up by the selection's branches
+                const size_t BLOCK = 64;
+                std::pair<int, KmerKey> block[BLOCK];
+                MinimizerIterator it(seq.seq.view(), encoder, window, begin, end, &seq.mask);
+                for (;;) {
+                    size_t n = 0;
+                    while (n < BLOCK && it.next()) {
+                        block[n++] = {it.pos(), it.key()};
+                    }
+                    for (size_t i = 0; i < n; ++i) {
+                        visit(seq.index, block[i].first, block[i].second);
+                    }
+                    if (n < BLOCK) break;
+                }
+                seeds += it.seedsRead();
+                continue;
+            }
+            KmerIterator it(seq.seq.view(), encoder, begin, end, &seq.mask);
+            while (it.next()) {
+                visit(seq.index, it.pos(), it.key());
+                ++seeds;
+            }
+        }
+    });
+    return seeds;
+}
+
+// Seconds elapsed since start
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Split [0, count) into one block per thread and run work(begin, end) on each
+template <typename Work>
+static void parallelBlocks(size_t count, int threads, Work work) {
+    size_t blocks = static_cast<size_t>(std::max(threads, 1));
+    parallelFor(blocks, threads, [&](size_t b, int) {
+        work(count * b / blocks, count * (b + 1) / blocks);
+    });
 }
 
-// Build k-mer hash index from database sequences
+// Build k-mer index from database sequences
 // Uses 2-bit encoding: A=0, C=1, G=2, T=3
-// Uses rolling hash for efficient k-mer extraction
-KmerIndex buildIndex(const std::vector<Sequence>& database, int k) {
+// Two passes: count the postings of every k-mer, then place each posting
+// directly into its final slot in the contiguous postings array.
+// Shard 0 counts into offsets[slot + 1] and later uses offsets[slot] as its
+// placement cursor, like a serial build; every further shard s gets its own
+// cursors[s - 1] array, which first holds its counts and then the position
+// its first posting of each slot goes to.
+KmerIndex buildIndex(const std::vector<Sequence>& database, const SeedShape& shape,
+                     IndexLayout layout, size_t direct_budget,
+                     int threads, IndexBuildStats* stats,
+                     uint64_t max_postings, int window) {
+    auto build_start = std::chrono::steady_clock::now();
+    IndexBuildStats timings;
+    threads = std::max(threads, 1);
+    timings.threads = threads;
+    
     KmerIndex index;
+    index.shape_ = shape;
+    index.window_ = std::max(window, 1);
+    int k = shape.weight();
+    
+    if (layout == IndexLayout::Auto) {
+        layout = k <= MAX_DIRECT_K && directTableBytes(k) <= direct_budget ? IndexLayout::Direct
+                                                      : IndexLayout::Hashed;
+    }
+    
+    size_t shards = static_cast<size_t>(threads);
+    std::vector<ShardStart> cuts = shardDatabase(database, shards);
+    std::vector<uint64_t>& offsets = index.owned_offsets_;
+    std::vector<KmerKey>& keys = index.owned_keys_;
+    std::vector<uint8_t> used;  // Hashed layout: occupied table slots
     
-    // For each sequence in database
+    IndexFilterStats filter;
+    filter.max_postings = max_postings;
     for (const auto& seq : database) {
-        const std::string& sequence = seq.seq;
-        
-        // Extract all k-mers using rolling window
-        // For each position from 0 to seq.length() - k
-        for (int i = 0; i <= static_cast<int>(sequence.length()) - k; ++i) {
-            // Get k-mer at position i
-            uint32_t kmer_key = getKmerAt(sequence, i, k);
-            
-            // Skip invalid k-mers (containing N or other invalid chars)
-            if (kmer_key == 0 && k > 0) {
-                // Check if it's actually invalid (not just a valid k-mer that encodes to 0)
-                bool valid = true;
-                for (int j = 0; j < k; ++j) {
-                    char c = sequence[i + j];
-                    if (c != 'A' && c != 'C' && c != 'G' && c != 'T' &&
-                        c != 'a' && c != 'c' && c != 'g' && c != 't') {
-                        valid = false;
-                        break;
+        filter.total_bases += seq.seq.length();
+        filter.masked_bases += maskedBases(seq.mask);
+    }
+    
+    if (layout == IndexLayout::Direct) {
+        offsets.assign((static_cast<size_t>(1) << (2 * k)) + 1, 0);
+    } else {
+        // Collect every k-mer of each shard and sort, so equal keys form
+        // runs, then merge the shards' distinct keys pairwise. With a stop
+        // list each distinct key also carries its number of postings.
+        auto phase_start = std::chrono::steady_clock::now();
+        std::vector<std::vector<KmerKey>> shard_keys(shards);
+        std::vector<std::vector<uint64_t>> shard_counts(max_postings > 0 ? shards : 0);
+        parallelFor(shards, threads, [&](size_t s, int) {
+            std::vector<KmerKey>& all_keys = shard_keys[s];
+            forEachShardKmer(database, cuts, s, shape, index.window_, [&](int, int, KmerKey key) {
+                all_keys.push_back(key);
+            });
+            std::sort(all_keys.begin(), all_keys.end());
+            if (max_postings == 0) {
+                all_keys.erase(std::unique(all_keys.begin(), all_keys.end()), all_keys.end());
+                return;
+            }
+            size_t out = 0;
+            for (size_t i = 0; i < all_keys.size(); ++out) {
+                size_t run = i;
+                while (run < all_keys.size() && all_keys[run] == all_keys[i]) ++run;
+                all_keys[out] = all_keys[i];
+                shard_counts[s].push_back(run - i);
+                i = run;
+            }
+            all_keys.resize(out);
+        });
+        for (size_t step = 1; step < shards; step *= 2) {
+            parallelFor((shards + 2 * step - 1) / (2 * step), threads, [&](size_t pair, int) {
+                size_t first = 2 * step * pair;
+                if (first + step >= shards) return;
+                std::vector<KmerKey>& a = shard_keys[first];
+                std::vector<KmerKey>& b = shard_keys[first + step];
+                std::vector<KmerKey> merged;
+                merged.reserve(a.size() + b.size());
+                if (max_postings == 0) {
+                    std::merge(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(merged));
+                    merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+                } else {
+                    const std::vector<uint64_t>& a_counts = shard_counts[first];
+                    const std::vector<uint64_t>& b_counts = shard_counts[first + step];
+                    std::vector<uint64_t> merged_counts;
+                    merged_counts.reserve(a.size() + b.size());
+                    size_t i = 0, j = 0;
+                    while (i < a.size() || j < b.size()) {
+                        if (j == b.size() || (i < a.size() && a[i] < b[j])) {
+                            merged.push_back(a[i]);
+                            merged_counts.push_back(a_counts[i++]);
+                        } else if (i == a.size() || b[j] < a[i]) {
+                            merged.push_back(b[j]);
+                            merged_counts.push_back(b_counts[j++]);
+                        } else {
+                            merged.push_back(a[i]);
+                            merged_counts.push_back(a_counts[i++] + b_counts[j++]);
+                        }
                     }
+                    shard_counts[first].swap(merged_counts);
+                    std::vector<uint64_t>().swap(shard_counts[first + step]);
+                }
+                a.swap(merged);
+                std::vector<KmerKey>().swap(b);
+            });
+        }
+        std::vector<KmerKey>& distinct = shard_keys[0];
+        
+        // Stop list: k-mers with too many postings never enter the table
+        if (max_postings > 0) {
+            const std::vector<uint64_t>& counts = shard_counts[0];
+            size_t out = 0;
+            for (size_t i = 0; i < distinct.size(); ++i) {
+                if (counts[i] > max_postings) {
+                    filter.stopped_kmers++;
+                    filter.stopped_postings += counts[i];
+                } else {
+                    distinct[out++] = distinct[i];
                 }
-                if (!valid) continue;
             }
-            
-            // Store (sequence_index, position) in hash table
-            index[kmer_key].push_back({seq.index, i});
+            distinct.resize(out);
         }
+        timings.keys_seconds = secondsSince(phase_start);
+        
+        // Table at most half full keeps probe sequences short. Keys go in
+        // in sorted order, so the table does not depend on the sharding.
+        phase_start = std::chrono::steady_clock::now();
+        size_t table_size = 2;
+        while (table_size < 2 * distinct.size()) table_size <<= 1;
+        keys.assign(table_size, 0);
+        offsets.assign(table_size + 1, 0);
+        index.keys_ = keys.data();
+        index.num_keys_ = table_size;
+        index.offsets_ = offsets.data();
+        index.setHashShift();
+        
+        used.assign(table_size, 0);
+        for (KmerKey key : distinct) {
+            size_t slot = index.hashSlot(key);
+            while (used[slot]) {
+                slot = (slot + 1) & (table_size - 1);
+            }
+            used[slot] = 1;
+            keys[slot] = key;
+        }
+        timings.table_seconds = secondsSince(phase_start);
+    }
+    
+    // Slot of a key, or NO_SLOT for a key on the stop list. Probing stops
+    // at the first unused slot (findSlot's empty-slot test needs final
+    // offsets)
+    const size_t NO_SLOT = SIZE_MAX;
+    size_t num_slots = offsets.size() - 1;
+    std::vector<uint8_t> stopped;  // Direct layout: slots on the stop list
+    auto slotOf = [&](KmerKey key) {
+        if (index.keys_ == nullptr) {
+            size_t slot = static_cast<size_t>(key);
+            return stopped.empty() || !stopped[slot] ? slot : NO_SLOT;
+        }
+        size_t slot = index.hashSlot(key);
+        while (keys[slot] != key || !used[slot]) {
+            if (!used[slot]) return NO_SLOT;
+            slot = (slot + 1) & (num_slots - 1);
+        }
+        return slot;
+    };
+    
+    // Pass 1: count postings per slot and shard, and the seeds that are
+    // not minimizers
+    auto phase_start = std::chrono::steady_clock::now();
+    std::vector<std::vector<uint64_t>> cursors(shards - 1);
+    std::atomic<uint64_t> sampled_seeds{0};
+    parallelFor(shards, threads, [&](size_t s, int) {
+        uint64_t* counts = offsets.data() + 1;
+        if (s > 0) {
+            cursors[s - 1].assign(num_slots, 0);
+            counts = cursors[s - 1].data();
+        }
+        uint64_t minimizers = 0;
+        uint64_t seeds = forEachShardKmer(database, cuts, s, shape, index.window_,
+                                          [&](int, int, KmerKey key) {
+            size_t slot = slotOf(key);
+            if (slot != NO_SLOT) counts[slot]++;
+            ++minimizers;
+        });
+        sampled_seeds += seeds - minimizers;
+    });
+    filter.sampled_seeds = sampled_seeds;
+    timings.count_seconds = secondsSince(phase_start);
+    
+    // Total per slot, with each later shard's count replaced by the number
+    // of postings of that slot in the shards before it
+    phase_start = std::chrono::steady_clock::now();
+    if (shards > 1) {
+        parallelBlocks(num_slots, threads, [&](size_t begin, size_t end) {
+            for (size_t slot = begin; slot < end; ++slot) {
+                uint64_t run = offsets[slot + 1];
+                for (auto& shard : cursors) {
+                    uint64_t count = shard[slot];
+                    shard[slot] = run;
+                    run += count;
+                }
+                offsets[slot + 1] = run;
+            }
+        });
     }
     
+    // Stop list for the direct layout, now that the totals are known: a
+    // k-mer over the limit gets no postings in any shard
+    if (max_postings > 0 && index.keys_ == nullptr) {
+        stopped.assign(num_slots, 0);
+        std::atomic<uint64_t> stopped_kmers{0}, stopped_postings{0};
+        parallelBlocks(num_slots, threads, [&](size_t begin, size_t end) {
+            uint64_t block_kmers = 0, block_postings = 0;
+            for (size_t slot = begin; slot < end; ++slot) {
+                if (offsets[slot + 1] <= max_postings) continue;
+                block_kmers++;
+                block_postings += offsets[slot + 1];
+                stopped[slot] = 1;
+                offsets[slot + 1] = 0;
+                for (auto& shard : cursors) {
+                    shard[slot] = 0;
+                }
+            }
+            stopped_kmers += block_kmers;
+            stopped_postings += block_postings;
+        });
+        filter.stopped_kmers = stopped_kmers;
+        filter.stopped_postings = stopped_postings;
+    }
+    
+    // Prefix sum turns the counts into start offsets: each block sums its
+    // range, then adds the total of the blocks before it
+    size_t blocks = static_cast<size_t>(threads);
+    std::vector<uint64_t> block_sums(blocks + 1, 0);
+    parallelFor(blocks, threads, [&](size_t b, int) {
+        size_t begin = 1 + num_slots * b / blocks;
+        size_t end = 1 + num_slots * (b + 1) / blocks;
+        for (size_t i = begin + 1; i < end; ++i) {
+            offsets[i] += offsets[i - 1];
+        }
+        block_sums[b + 1] = end > begin ? offsets[end - 1] : 0;
+    });
+    for (size_t b = 1; b <= blocks; ++b) {
+        block_sums[b] += block_sums[b - 1];
+    }
+    parallelFor(blocks, threads, [&](size_t b, int) {
+        size_t begin = 1 + num_slots * b / blocks;
+        size_t end = 1 + num_slots * (b + 1) / blocks;
+        for (size_t i = begin; i < end; ++i) {
+            offsets[i] += block_sums[b];
+        }
+    });
+    if (shards > 1) {
+        parallelBlocks(num_slots, threads, [&](size_t begin, size_t end) {
+            for (auto& shard : cursors) {
+                for (size_t slot = begin; slot < end; ++slot) {
+                    shard[slot] += offsets[slot];
+                }
+            }
+        });
+    }
+    index.offsets_ = offsets.data();
+    timings.prefix_seconds = secondsSince(phase_start);
+    
+    // Pass 2: write each posting at the next free slot of its k-mer.
+    // Shards and, within a shard, sequences and positions are visited in
+    // order, so every posting list ends up sorted by (sequence, position)
+    phase_start = std::chrono::steady_clock::now();
+    std::vector<Posting>& postings = index.owned_postings_;
+    postings.resize(offsets.back());
+    parallelFor(shards, threads, [&](size_t s, int) {
+        uint64_t* cursor = s == 0 ? offsets.data() : cursors[s - 1].data();
+        forEachShardKmer(database, cuts, s, shape, index.window_, [&](int sid, int pos, KmerKey key) {
+            size_t slot = slotOf(key);
+            if (slot != NO_SLOT) postings[cursor[slot]++] = makePosting(sid, pos);
+        });
+    });
+    
+    // The last shard's cursors now point at the start of the next slot
+    if (shards == 1) {
+        for (size_t i = offsets.size() - 1; i > 0; --i) {
+            offsets[i] = offsets[i - 1];
+        }
+    } else {
+        const std::vector<uint64_t>& ends = cursors.back();
+        parallelBlocks(num_slots, threads, [&](size_t begin, size_t end) {
+            for (size_t slot = begin; slot < end; ++slot) {
+                offsets[slot + 1] = ends[slot];
+            }
+        });
+    }
+    offsets[0] = 0;
+    index.postings_ = postings.data();
+    index.num_postings_ = postings.size();
+    timings.place_seconds = secondsSince(phase_start);
+    
+    index.filter_ = filter;
+    timings.total_seconds = secondsSince(build_start);
+    if (stats != nullptr) {
+        *stats = timings;
+    }
     return index;
 }
 
+// Measure the encoding of every slot, turn the sizes into byte offsets,
+// then encode each slot again straight into its place
+void KmerIndex::compressPostings(int threads) {
+    if (isCompressed() || offsets_ != owned_offsets_.data() || numOffsets() == 0) {
+        return;
+    }
+    size_t num_slots = numOffsets() - 1;
+    std::vector<uint64_t> byte_offsets(num_slots + 1, 0);
+    parallelBlocks(num_slots, threads, [&](size_t begin, size_t end) {
+        std::vector<uint8_t> encoded;
+        for (size_t slot = begin; slot < end; ++slot) {
+            encodePostings(postings_ + offsets_[slot], postings_ + offsets_[slot + 1], encoded);
+            byte_offsets[slot + 1] = encoded.size();
+        }
+    });
+    for (size_t slot = 1; slot <= num_slots; ++slot) {
+        byte_offsets[slot] += byte_offsets[slot - 1];
+    }
+    
+    owned_blocks_.assign(byte_offsets.back() + POSTING_BLOCK_PADDING, 0);
+    parallelBlocks(num_slots, threads, [&](size_t begin, size_t end) {
+        std::vector<uint8_t> encoded;
+        for (size_t slot = begin; slot < end; ++slot) {
+            encodePostings(postings_ + offsets_[slot], postings_ + offsets_[slot + 1], encoded);
+            std::copy(encoded.begin(), encoded.end(), owned_blocks_.begin() + byte_offsets[slot]);
+        }
+    });
+    
+    owned_offsets_.swap(byte_offsets);
+    offsets_ = owned_offsets_.data();
+    std::vector<Posting>().swap(owned_postings_);
+    postings_ = nullptr;
+    blocks_ = owned_blocks_.data();
+    block_bytes_ = owned_blocks_.size();
+}
@@ -1,27 +1,527 @@
 #ifndef INDEX_H
 #define INDEX_H
 
-#include <unordered_map>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
 #include "fasta.h"
+#include "seed.h"
 
-// Hash table: k-mer key -> list of (sequence_index, position)
-// Using uint32_t for k-mer encoding (supports k up to 16)
-using KmerIndex = std::unordered_map<uint32_t, std::vector<std::pair<int, int>>>;
+// Posting: one occurrence of a k-mer, packed into a single 64-bit word
+// High 32 bits: sequence index in database, low 32 bits: position
+using Posting = uint64_t;
 
-// Build k-mer hash index from database sequences
+inline Posting makePosting(int seq_index, int pos) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(seq_index)) << 32) |
+           static_cast<uint32_t>(pos);
+}
+
+inline int postingSeq(Posting posting) {
+    return static_cast<int>(posting >> 32);
+}
+
+inline int postingPos(Posting posting) {
+    return static_cast<int>(posting & 0xFFFFFFFFu);
+}
+
+// Contiguous run of postings for one k-mer, ordered by (sequence, position)
+struct PostingList {
+    const Posting* first = nullptr;
+    const Posting* last = nullptr;
+
+    const Posting* begin() const { return first; }
+    const Posting* end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    bool empty() const { return first == last; }
+};
+
+// Postings per block of a compressed index
+const size_t POSTING_BLOCK = 128;
+
+// Zero bytes after the blocks of a compressed index, so bit unpacking can
+// always read a whole word
+const size_t POSTING_BLOCK_PADDING = 8;
+
+// Reads the postings of one k-mer of a compressed index, a block at a
+// time. The list is its number of postings as a varint, then blocks of
+// POSTING_BLOCK postings (the last may be shorter). A block starts with its
+// first posting, sequence and position as varints, so it decodes on its
+// own and the blocks before it need not be. If it has more postings, two
+// bytes give the bit widths of two packed arrays that follow: the
+// sequence delta of each later posting, then its position delta (same
+// sequence) or its position (a later sequence). Fixed-width fields and
+// no branches per field keep the unpacking loops vectorizable.
+class PostingDecoder {
+public:
+    PostingDecoder() = default;
+
+    // Postings encoded at data; an empty list has no bytes at all
+    PostingDecoder(const uint8_t* data, bool empty) : data_(data) {
+        if (!empty) {
+            size_ = left_ = readVarint();
+        }
+    }
+
+    size_t size() const { return size_; }
+
+    // Decode the next block into out (room for POSTING_BLOCK postings);
+    // returns how many it held, 0 at the end of the list
+    size_t next(Posting* out) {
+        if (left_ == 0) return 0;
+        size_t n = std::min<size_t>(left_, POSTING_BLOCK);
+        left_ -= n;
+        uint32_t seq = static_cast<uint32_t>(readVarint());
+        uint32_t pos = static_cast<uint32_t>(readVarint());
+        out[0] = makePosting(static_cast<int>(seq), static_cast<int>(pos));
+        if (n == 1) return 1;
+        
+        unsigned seq_width = data_[0];
+        unsigned pos_width = data_[1];
+        data_ += 2;
+        uint32_t seq_deltas[POSTING_BLOCK];
+        uint32_t positions[POSTING_BLOCK];
+        data_ = unpack(data_, n - 1, seq_width, seq_deltas);
+        data_ = unpack(data_, n - 1, pos_width, positions);
+        for (size_t i = 1; i < n; ++i) {
+            uint32_t delta = seq_deltas[i - 1];
+            seq += delta;
+            pos = (delta == 0 ? pos : 0) + positions[i - 1];
+            out[i] = makePosting(static_cast<int>(seq), static_cast<int>(pos));
+        }
+        return n;
+    }
+
+private:
+    uint64_t readVarint() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; ; shift += 7) {
+            uint8_t byte = *data_++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (byte < 0x80) return value;
+        }
+    }
+
+    // Unpack count values of width bits (at most 32) into out; returns
+    // the first byte after them
+    static const uint8_t* unpack(const uint8_t* data, size_t count, unsigned width,
+                                 uint32_t* out) {
+        uint64_t mask = (static_cast<uint64_t>(1) << width) - 1;
+        for (size_t i = 0; i < count; ++i) {
+            size_t bit = i * width;
+            uint64_t word;
+            std::memcpy(&word, data + bit / 8, sizeof(word));
+            out[i] = static_cast<uint32_t>((word >> (bit % 8)) & mask);
+        }
+        return data + (count * width + 7) / 8;
+    }
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t left_ = 0;
+};
+
+// Wall-clock seconds spent in each phase of buildIndex
+struct IndexBuildStats {
+    int threads = 1;
+    double keys_seconds = 0;      // Hashed layout: collect and merge distinct k-mers
+    double table_seconds = 0;     // Hashed layout: insert them into the table
+    double count_seconds = 0;     // Count postings per k-mer and shard
+    double prefix_seconds = 0;    // Turn counts into offsets and shard cursors
+    double place_seconds = 0;     // Write every posting into its slot
+    double total_seconds = 0;
+};
+
+// What was kept out of an index: k-mers on the stop list, and database
+// bases inside mask intervals (which start no seeds)
+struct IndexFilterStats {
+    uint64_t max_postings = 0;       // Stop-list limit (0 = no stop list)
+    uint64_t stopped_kmers = 0;      // K-mers with more postings than that
+    uint64_t stopped_postings = 0;   // Postings they would have had
+    uint64_t masked_bases = 0;
+    uint64_t total_bases = 0;
+    uint64_t sampled_seeds = 0;      // Valid seeds that are no window's minimizer
+};
+
+// How the offsets array of a KmerIndex is addressed
+enum class IndexLayout {
+    Auto,    // Direct if its table fits the memory budget, else Hashed
+    Direct,  // offsets indexed by the encoded k-mer (4^k + 1 entries, k <= 16)
+    Hashed   // open-addressing table of the k-mers that occur
+};
+
+// Default memory budget for the direct offsets table: 4^12 + 1 offsets
+const size_t DEFAULT_DIRECT_INDEX_BUDGET = static_cast<size_t>(128) << 20;
+
+// Largest k (seed weight) the direct layout supports
+const int MAX_DIRECT_K = 16;
+
+// Bytes needed by the direct offsets table for k
+size_t directTableBytes(int k);
+
+// K-mer index in compressed sparse row form: the postings of all k-mers
+// live in one contiguous array, and an offsets array marks where each
+// k-mer's postings start and end. The k-mers may be spaced seeds; k is
+// then the seed's weight and postings record where its span starts.
+//   Direct layout: offsets has 4^k + 1 entries and is indexed by the
+//     encoded k-mer itself, so a lookup is two array reads.
+//   Hashed layout: keys is a power-of-two open-addressing table of the
+//     k-mers that occur, and slot i owns postings [offsets[i], offsets[i+1]).
+//     Empty slots own no postings, which is how probing detects them.
+// A compressed index (compressPostings) keeps the postings of each k-mer
+// in blocks instead (see PostingDecoder), and offsets are then byte
+// offsets into them.
+// A minimizer index (window > 1) holds only the seeds that are the
+// minimizer of some window of that many consecutive seeds (see
+// MinimizerIterator), and queries are seeded with their own minimizers.
+// The arrays are either owned by the index (buildIndex) or borrowed from a
+// mapped index file (KmerIndex::view), so the index is move-only.
+class KmerIndex {
+public:
+    KmerIndex() = default;
+    KmerIndex(KmerIndex&&) = default;
+    KmerIndex& operator=(KmerIndex&&) = default;
+    KmerIndex(const KmerIndex&) = delete;
+    KmerIndex& operator=(const KmerIndex&) = delete;
+
+    // Wrap arrays owned elsewhere; keys == nullptr selects the direct
+    // layout, and blocks (with postings == nullptr) a compressed index
+    static KmerIndex view(const SeedShape& shape,
+                          const KmerKey* keys, size_t num_keys,
+                          const uint64_t* offsets,
+                          const Posting* postings, size_t num_postings,
+                          const IndexFilterStats& filter = IndexFilterStats(),
+                          int window = 1,
+                          const uint8_t* blocks = nullptr, size_t block_bytes = 0);
+
+    int k() const { return shape_.weight(); }
+    const SeedShape& shape() const { return shape_; }
+
+    // Minimizer window (1 when every seed is indexed)
+    int window() const { return window_; }
+
+    // Shortest exact match that is sure to share a seed with the index
+    int guaranteedMatch() const { return shape_.span() + window_ - 1; }
+    IndexLayout layout() const {
+        return keys_ == nullptr ? IndexLayout::Direct : IndexLayout::Hashed;
+    }
+    bool isDirect() const { return keys_ == nullptr; }
+
+    bool isCompressed() const { return blocks_ != nullptr; }
+
+    // Postings of an encoded k-mer (empty if it does not occur); the index
+    // must not be compressed
+    PostingList lookup(KmerKey key) const {
+        size_t slot = isDirect() ? key : findSlot(key);
+        return PostingList{postings_ + offsets_[slot], postings_ + offsets_[slot + 1]};
+    }
+
+    // Same for a compressed index; nothing is decoded until the decoder
+    // is read
+    PostingDecoder decoder(KmerKey key) const {
+        size_t slot = isDirect() ? key : findSlot(key);
+        return PostingDecoder(blocks_ + offsets_[slot], offsets_[slot] == offsets_[slot + 1]);
+    }
+
+    // Re-encode the postings in compressed blocks, on `threads` workers,
+    // and free the plain array. Only for an index built in memory.
+    void compressPostings(int threads = 1);
+
+    // Raw arrays, for writing the index to a file
+    const KmerKey* keys() const { return keys_; }
+    size_t numKeys() const { return num_keys_; }
+    const uint64_t* offsets() const { return offsets_; }
+    size_t numOffsets() const;
+    const Posting* postings() const { return postings_; }
+    size_t numPostings() const { return num_postings_; }
+    const uint8_t* blocks() const { return blocks_; }
+    size_t blockBytes() const { return block_bytes_; }   // Padding included
+
+    // Total bytes of the index arrays
+    size_t memoryBytes() const;
+
+    // Stop list and masking applied when the index was built
+    const IndexFilterStats& filterStats() const { return filter_; }
+
+private:
+    friend KmerIndex buildIndex(const std::vector<Sequence>& database, const SeedShape& shape,
+                                IndexLayout layout, size_t direct_budget,
+                                int threads, IndexBuildStats* stats,
+                                uint64_t max_postings, int window);
+
+    // Home slot of a key in the hashed table
+    size_t hashSlot(KmerKey key) const {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> hash_shift_);
+    }
+
+    // Slot holding key in the hashed table, or an empty slot if it is absent
+    size_t findSlot(KmerKey key) const {
+        size_t mask = num_keys_ - 1;
+        size_t slot = hashSlot(key);
+        while (offsets_[slot] != offsets_[slot + 1] && keys_[slot] != key) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void setHashShift();
+
+    SeedShape shape_;
+    int window_ = 1;
+    const KmerKey* keys_ = nullptr;
+    size_t num_keys_ = 0;
+    int hash_shift_ = 64;
+    const uint64_t* offsets_ = nullptr;
+    const Posting* postings_ = nullptr;
+    size_t num_postings_ = 0;
+    const uint8_t* blocks_ = nullptr;
+    size_t block_bytes_ = 0;
+    IndexFilterStats filter_;
+
+    std::vector<KmerKey> owned_keys_;
+    std::vector<uint64_t> owned_offsets_;
+    std::vector<Posting> owned_postings_;
+    std::vector<uint8_t> owned_blocks_;
+};
+
+// Build k-mer index from database sequences
 // Uses 2-bit encoding: A=0, C=1, G=2, T=3
-// Uses rolling hash for efficient k-mer extraction
-KmerIndex buildIndex(const std::vector<Sequence>& database, int k);
+// Keys are the seeds of the given shape (SeedShape::contiguous(k) for
+// plain k-mers); the direct layout needs a weight of at most MAX_DIRECT_K
+// Two passes: count the postings of every k-mer, then place each posting
+// directly into its final slot in the contiguous postings array
+// With IndexLayout::Auto the direct layout is used when directTableBytes(k)
+// fits in direct_budget bytes
+// With threads > 1 the database is cut into that many shards of equal
+// length, each counted and placed by its own thread; the arrays are
+// identical to a single-threaded build. Each extra thread needs one more
+// 8-byte cursor per offsets entry while building.
+// If stats is not null it receives the time spent in each phase.
+// Seeds overlapping a sequence's mask intervals are not indexed. With
+// max_postings > 0, k-mers with more postings than that are left out
+// entirely (a stop list): such k-mers come from repeats, and every query
+// hit on them would trigger that many extensions.
+// With window > 1 only the (window, k)-minimizers are indexed, which
+// shrinks the postings to about 2 / (window + 1) of all seeds.
+KmerIndex buildIndex(const std::vector<Sequence>& database, const SeedShape& shape,
+                     IndexLayout layout = IndexLayout::Auto,
+                     size_t direct_budget = DEFAULT_DIRECT_INDEX_BUDGET,
+                     int threads = 1, IndexBuildStats* stats = nullptr,
+                     uint64_t max_postings = 0, int window = 1);
 
-// Encode a k-mer string to integer using 2-bit encoding
+// Largest minimizer window buildIndex accepts
+const int MAX_MINIMIZER_WINDOW = 256;
+
+// Encode a k-mer string (up to 32 bases) to integer using 2-bit encoding
 // Each nucleotide takes 2 bits: A=00, C=01, G=10, T=11
-uint32_t encodeKmer(const std::string& kmer);
+KmerKey encodeKmer(const std::string& kmer);
 
-// Extract k-mer at position i from sequence using rolling hash
-// Returns encoded k-mer value
-uint32_t getKmerAt(const std::string& seq, int pos, int k);
+// Extract k-mer at position pos from a packed sequence into *key
+// Returns false if it runs past the end or contains an ambiguous base,
+// so a poly-A k-mer (key 0) is never confused with an invalid one
+bool getKmerAt(const PackedView& seq, int pos, int k, KmerKey* key);
 
-#endif // INDEX_H
+// Streams the valid seeds of a packed sequence in position order,
+// shifting in one base per step and gathering each key from the window of
+// the seed's span with a SeedEncoder. Seeds whose span overlaps an
+// ambiguity run or an interval of the optional mask are skipped, and the
+// window refills from the first base after it.
+//   withSeedEncoder(shape, [&](const auto& encoder) {
+//       KmerIterator it(seq, encoder);
+//       while (it.next()) use(it.pos(), it.key());
+//   });
+template <typename Encoder>
+class KmerIterator {
+public:
+    KmerIterator(const PackedView& seq, const Encoder& encoder,
+                 const std::vector<MaskInterval>* mask = nullptr)
+        : seq_(seq), encoder_(encoder), span_(encoder.span()),
+          end_base_(seq.length),
+          run_(seq.runs), runs_end_(seq.runs + seq.num_runs) {
+        if (mask != nullptr) {
+            mask_ = mask->data();
+            mask_end_ = mask->data() + mask->size();
+        }
+        setBarrier();
+    }
+
+    // Only the seeds starting in [begin, end)
+    KmerIterator(const PackedView& seq, const Encoder& encoder, size_t begin, size_t end,
+                 const std::vector<MaskInterval>* mask = nullptr)
+        : KmerIterator(seq, encoder, mask) {
+        end_base_ = std::min(seq.length, end + span_ - 1);
+        next_base_ = begin;
+        while (run_ != runs_end_ && run_->pos + run_->len <= begin) {
+            ++run_;
+        }
+        while (mask_ != mask_end_ && mask_->pos + mask_->len <= begin) {
+            ++mask_;
+        }
+        setBarrier();
+    }
 
+    // Advance to the next valid seed; returns false at the end
+    bool next() {
+        while (next_base_ < end_base_) {
+            if (next_base_ >= barrier_) {
+                skipBarrier();
+                continue;
+            }
+            window_ = ((window_ << 2) | seq_.code(next_base_)) & encoder_.spanMask();
+            ++next_base_;
+            if (++filled_ >= span_) return true;
+        }
+        return false;
+    }
+
+    int pos() const { return static_cast<int>(next_base_) - span_; }
+    KmerKey key() const { return encoder_(window_); }
+
+private:
+    // Start of the next ambiguity run or mask interval
+    void setBarrier() {
+        barrier_ = SIZE_MAX;
+        if (run_ != runs_end_) barrier_ = run_->pos;
+        if (mask_ != mask_end_) barrier_ = std::min<size_t>(barrier_, mask_->pos);
+    }
+
+    // Restart the window after the runs and intervals starting here
+    // (they may overlap or chain)
+    void skipBarrier() {
+        bool skipped = true;
+        while (skipped) {
+            skipped = false;
+            while (run_ != runs_end_ && run_->pos <= next_base_) {
+                next_base_ = std::max<size_t>(next_base_, static_cast<size_t>(run_->pos) + run_->len);
+                ++run_;
+                skipped = true;
+            }
+            while (mask_ != mask_end_ && mask_->pos <= next_base_) {
+                next_base_ = std::max<size_t>(next_base_, static_cast<size_t>(mask_->pos) + mask_->len);
+                ++mask_;
+                skipped = true;
+            }
+        }
+        filled_ = 0;
+        setBarrier();
+    }
+
+    PackedView seq_;
+    Encoder encoder_;
+    int span_;
+    uint64_t window_ = 0;          // Last span bases shifted in
+    size_t end_base_;              // One past the last base to shift in
+    size_t next_base_ = 0;         // Next base to shift in
+    size_t barrier_ = SIZE_MAX;    // Next base that starts a run or interval
+    int filled_ = 0;               // Valid bases currently in the window
+    const AmbiguityRun* run_;      // Next ambiguity run to skip
+    const AmbiguityRun* runs_end_;
+    const MaskInterval* mask_ = nullptr;      // Next mask interval to skip
+    const MaskInterval* mask_end_ = nullptr;
+};
+
+// Order of seeds for minimizer selection. It is a bijection, so only equal
+// keys tie, and it scatters the keys so that poly-A (key 0) does not win
+// every window it touches.
+inline uint64_t minimizerHash(KmerKey key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDull;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+// Streams the (window, k)-minimizers of a packed sequence in position
+// order: of every `window` valid seeds at consecutive positions, the one
+// with the least minimizerHash (the leftmost on a tie), each reported once.
+// The choice depends only on the bases of the window, so two sequences
+// sharing an exact match of at least window + span - 1 bases share a
+// minimizer at the same offset of the match. A stretch of fewer than
+// `window` consecutive valid seeds has no minimizer.
+template <typename Encoder>
+class MinimizerIterator {
+public:
+    MinimizerIterator(const PackedView& seq, const Encoder& encoder, int window,
+                      const std::vector<MaskInterval>* mask = nullptr)
+        : seeds_(seq, encoder, mask), window_(window) {
+        setRingMask();
+    }
+
+    // Only the minimizers starting in [begin, end); the seeds of the
+    // windows around them are read, so shards of one sequence together
+    // give exactly its minimizers
+    MinimizerIterator(const PackedView& seq, const Encoder& encoder, int window,
+                      size_t begin, size_t end,
+                      const std::vector<MaskInterval>* mask = nullptr)
+        : seeds_(seq, encoder, begin - std::min<size_t>(begin, window - 1),
+                 end + window - 1, mask),
+          window_(window), begin_(static_cast<int64_t>(begin)), end_(static_cast<int64_t>(end)) {
+        setRingMask();
+    }
+
+    // Advance to the next minimizer; returns false at the end
+    bool next() {
+        while (seeds_.next()) {
+            int64_t pos = seeds_.pos();
+            if (pos != last_pos_ + 1) {
+                filled_ = 0;
+            }
+            last_pos_ = pos;
+            seeds_in_range_ += pos >= begin_ && pos < end_;
+            
+            // The minimum changes when a smaller seed comes in, or when it
+            // leaves the window and the window is scanned again
+            Candidate seed{minimizerHash(seeds_.key()), pos, seeds_.key()};
+            ring_[pos & ring_mask_] = seed;
+            if (filled_++ == 0 || seed.hash < min_.hash) {
+                min_ = seed;
+            } else if (min_.pos <= pos - window_) {
+                min_ = ring_[(pos - window_ + 1) & ring_mask_];
+                for (int64_t p = pos - window_ + 2; p <= pos; ++p) {
+                    if (ring_[p & ring_mask_].hash < min_.hash) min_ = ring_[p & ring_mask_];
+                }
+            }
+            if (filled_ < window_ || min_.pos == current_.pos || min_.pos < begin_) continue;
+            if (min_.pos >= end_) return false;
+            current_ = min_;
+            return true;
+        }
+        return false;
+    }
+
+    int pos() const { return static_cast<int>(current_.pos); }
+    KmerKey key() const { return current_.key; }
+
+    // Valid seeds starting in the range read so far, minimizers or not
+    uint64_t seedsRead() const { return seeds_in_range_; }
+
+private:
+    struct Candidate {
+        uint64_t hash;
+        int64_t pos;
+        KmerKey key;
+    };
+    
+    void setRingMask() {
+        size_t size = 1;
+        while (size < static_cast<size_t>(window_)) size <<= 1;
+        ring_mask_ = static_cast<int64_t>(size) - 1;
+    }
+    
+    KmerIterator<Encoder> seeds_;
+    int window_;
+    int64_t begin_ = 0;
+    int64_t end_ = INT64_MAX;
+    Candidate ring_[MAX_MINIMIZER_WINDOW];  // Seeds of the window, by position
+    int64_t ring_mask_ = 0;
+    int filled_ = 0;                // Consecutive valid seeds read
+    int64_t last_pos_ = -2;
+    Candidate min_{0, -1, 0};       // Least seed of the window, the leftmost on a tie
+    Candidate current_{0, -1, 0};
+    uint64_t seeds_in_range_ = 0;
+};
+
+#endif // INDEX_H
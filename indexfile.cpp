@@ -0,0 +1,346 @@
+#include "indexfile.h"
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Round a section offset up to the next 8-byte boundary
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + 7) & ~static_cast<uint64_t>(7);
+}
+
+// Pad the output stream with zeros up to the given offset
+static void padTo(std::ofstream& out, uint64_t offset) {
+    static const char zeros[8] = {0};
+    uint64_t current = static_cast<uint64_t>(out.tellp());
+    if (current < offset) {
+        out.write(zeros, static_cast<std::streamsize>(offset - current));
+    }
+}
+
+// Whether count elements of size bytes at offset fit below limit, with
+// the offset aligned to 8 bytes (the products cannot overflow)
+static bool sectionFits(uint64_t offset, uint64_t count, uint64_t size, uint64_t limit) {
+    return offset % 8 == 0 && offset <= limit && count <= (limit - offset) / size;
+}
+
+// Write database sequences and their k-mer index to an index file
+bool writeIndexFile(const std::string& filename,
+                    const std::vector<Sequence>& database,
+                    const KmerIndex& index) {
+    uint64_t name_bytes = 0;
+    uint64_t num_words = 0;
+    uint64_t num_runs = 0;
+    for (const auto& seq : database) {
+        name_bytes += seq.id.size() + seq.species.size();
+        num_words += seq.seq.words().size();
+        num_runs += seq.seq.runs().size();
+    }
+
+    IndexFileHeader header = {};
+    header.magic = INDEX_FILE_MAGIC;
+    header.version = INDEX_FILE_VERSION;
+    header.k = static_cast<uint32_t>(index.k());
+    header.layout = index.isDirect() ? 0 : 1;
+    header.seed_span = static_cast<uint32_t>(index.shape().span());
+    header.window = static_cast<uint32_t>(index.window());
+    header.compressed = index.isCompressed() ? 1 : 0;
+    header.seed_mask = index.shape().mask();
+    const IndexFilterStats& filter = index.filterStats();
+    header.max_postings = filter.max_postings;
+    header.stopped_kmers = filter.stopped_kmers;
+    header.stopped_postings = filter.stopped_postings;
+    header.masked_bases = filter.masked_bases;
+    header.total_bases = filter.total_bases;
+    header.sampled_seeds = filter.sampled_seeds;
+    header.num_sequences = database.size();
+    header.num_words = num_words;
+    header.num_runs = num_runs;
+    header.num_keys = index.isDirect() ? 0 : index.numKeys();
+    header.num_offsets = index.numOffsets();
+    header.num_postings = index.numPostings();
+    header.block_bytes = index.isCompressed() ? index.blockBytes() : 0;
+    header.records_offset = alignOffset(sizeof(IndexFileHeader));
+    header.names_offset = alignOffset(header.records_offset +
+                                      database.size() * sizeof(SequenceRecord));
+    header.words_offset = alignOffset(header.names_offset + name_bytes);
+    header.runs_offset = alignOffset(header.words_offset + num_words * sizeof(uint64_t));
+    header.keys_offset = alignOffset(header.runs_offset + num_runs * sizeof(AmbiguityRun));
+    header.offsets_offset = alignOffset(header.keys_offset +
+                                        header.num_keys * sizeof(KmerKey));
+    header.postings_offset = alignOffset(header.offsets_offset +
+                                         header.num_offsets * sizeof(uint64_t));
+    header.file_size = header.postings_offset +
+                       (index.isCompressed() ? header.block_bytes
+                                             : header.num_postings * sizeof(Posting));
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Error: Cannot create index file: " << filename << std::endl;
+        return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Sequence records
+    padTo(out, header.records_offset);
+    uint64_t name_offset = 0;
+    uint64_t word_offset = 0;
+    uint64_t run_offset = 0;
+    for (const auto& seq : database) {
+        SequenceRecord record = {};
+        record.name_offset = name_offset;
+        record.id_length = static_cast<uint32_t>(seq.id.size());
+        record.species_length = static_cast<uint32_t>(seq.species.size());
+        record.word_offset = word_offset;
+        record.seq_length = seq.seq.length();
+        record.run_offset = run_offset;
+        record.num_runs = seq.seq.runs().size();
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        name_offset += seq.id.size() + seq.species.size();
+        word_offset += seq.seq.words().size();
+        run_offset += seq.seq.runs().size();
+    }
+
+    // Names, packed bases and ambiguity runs
+    padTo(out, header.names_offset);
+    for (const auto& seq : database) {
+        out.write(seq.id.data(), static_cast<std::streamsize>(seq.id.size()));
+        out.write(seq.species.data(), static_cast<std::streamsize>(seq.species.size()));
+    }
+    padTo(out, header.words_offset);
+    for (const auto& seq : database) {
+        const std::vector<uint64_t>& words = seq.seq.words();
+        out.write(reinterpret_cast<const char*>(words.data()),
+                  static_cast<std::streamsize>(words.size() * sizeof(uint64_t)));
+    }
+    padTo(out, header.runs_offset);
+    for (const auto& seq : database) {
+        const std::vector<AmbiguityRun>& runs = seq.seq.runs();
+        out.write(reinterpret_cast<const char*>(runs.data()),
+                  static_cast<std::streamsize>(runs.size() * sizeof(AmbiguityRun)));
+    }
+
+    // K-mer index arrays
+    padTo(out, header.keys_offset);
+    out.write(reinterpret_cast<const char*>(index.keys()),
+              static_cast<std::streamsize>(header.num_keys * sizeof(KmerKey)));
+    padTo(out, header.offsets_offset);
+    out.write(reinterpret_cast<const char*>(index.offsets()),
+              static_cast<std::streamsize>(header.num_offsets * sizeof(uint64_t)));
+    padTo(out, header.postings_offset);
+    if (index.isCompressed()) {
+        out.write(reinterpret_cast<const char*>(index.blocks()),
+                  static_cast<std::streamsize>(header.block_bytes));
+    } else {
+        out.write(reinterpret_cast<const char*>(index.postings()),
+                  static_cast<std::streamsize>(header.num_postings * sizeof(Posting)));
+    }
+
+    out.close();
+    if (!out) {
+        std::cerr << "Error: Failed writing index file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+MappedIndex::~MappedIndex() {
+    close();
+}
+
+// Map an index file and validate its header
+bool MappedIndex::open(const std::string& filename) {
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: Cannot open index file: " << filename << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(IndexFileHeader))) {
+        std::cerr << "Error: Index file is truncated: " << filename << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    size_t length = static_cast<size_t>(st.st_size);
+    void* addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Error: Cannot map index file: " << filename << std::endl;
+        return false;
+    }
+
+    data_ = static_cast<const unsigned char*>(addr);
+    length_ = length;
+    header_ = reinterpret_cast<const IndexFileHeader*>(data_);
+
+    if (header_->magic != INDEX_FILE_MAGIC) {
+        std::cerr << "Error: Not an index file: " << filename << std::endl;
+        close();
+        return false;
+    }
+    if (header_->version != INDEX_FILE_VERSION) {
+        std::cerr << "Error: Index file " << filename << " has version "
+                  << header_->version << ", expected " << INDEX_FILE_VERSION
+                  << " (rebuild it with --makedb)" << std::endl;
+        close();
+        return false;
+    }
+    bool direct = header_->layout == 0;
+    bool compressed = header_->compressed == 1;
+    bool valid_k = header_->k >= 1 && header_->k <= 32 &&
+                   SeedShape::isValid(header_->seed_mask, static_cast<int>(header_->seed_span)) &&
+                   __builtin_popcountll(header_->seed_mask) == static_cast<int>(header_->k) &&
+                   (!direct || header_->k <= static_cast<uint32_t>(MAX_DIRECT_K));
+    bool valid_keys = direct ? header_->num_keys == 0
+                             : (header_->num_keys & (header_->num_keys - 1)) == 0 &&
+                               header_->num_keys >= 2;
+    bool valid_window = header_->window >= 1 &&
+                        header_->window <= static_cast<uint32_t>(MAX_MINIMIZER_WINDOW);
+    bool valid_blocks = header_->compressed == 0 ? header_->block_bytes == 0
+                        : header_->compressed == 1 && header_->block_bytes >= POSTING_BLOCK_PADDING;
+    uint64_t expected_offsets = !valid_k ? 0
+        : direct ? (static_cast<uint64_t>(1) << (2 * header_->k)) + 1
+        : header_->num_keys + 1;
+    if (!valid_k || !valid_keys || !valid_window || !valid_blocks || header_->layout > 1 ||
+        header_->file_size != length_ ||
+        header_->postings_offset > length_ ||
+        header_->num_offsets != expected_offsets) {
+        std::cerr << "Error: Index file is corrupt: " << filename << std::endl;
+        close();
+        return false;
+    }
+
+    // Every section must lie inside the file, before the next one, so no
+    // offset or count in the header can point a view past the mapping
+    uint64_t postings_count = compressed ? header_->block_bytes : header_->num_postings;
+    uint64_t postings_size = compressed ? 1 : sizeof(Posting);
+    bool valid_sections =
+        header_->records_offset >= sizeof(IndexFileHeader) &&
+        header_->num_sequences <= static_cast<uint64_t>(INT32_MAX) &&
+        sectionFits(header_->records_offset, header_->num_sequences, sizeof(SequenceRecord),
+                    header_->names_offset) &&
+        sectionFits(header_->names_offset, 0, 1, header_->words_offset) &&
+        sectionFits(header_->words_offset, header_->num_words, sizeof(uint64_t),
+                    header_->runs_offset) &&
+        sectionFits(header_->runs_offset, header_->num_runs, sizeof(AmbiguityRun),
+                    header_->keys_offset) &&
+        sectionFits(header_->keys_offset, header_->num_keys, sizeof(KmerKey),
+                    header_->offsets_offset) &&
+        sectionFits(header_->offsets_offset, header_->num_offsets, sizeof(uint64_t),
+                    header_->postings_offset) &&
+        sectionFits(header_->postings_offset, postings_count, postings_size, length_);
+    if (!valid_sections || !validRecords() || !validOffsets()) {
+        std::cerr << "Error: Index file is corrupt: " << filename << std::endl;
+        close();
+        return false;
+    }
+
+    records_ = reinterpret_cast<const SequenceRecord*>(data_ + header_->records_offset);
+    names_ = reinterpret_cast<const char*>(data_ + header_->names_offset);
+    words_ = reinterpret_cast<const uint64_t*>(data_ + header_->words_offset);
+    runs_ = reinterpret_cast<const AmbiguityRun*>(data_ + header_->runs_offset);
+    IndexFilterStats filter;
+    filter.max_postings = header_->max_postings;
+    filter.stopped_kmers = header_->stopped_kmers;
+    filter.stopped_postings = header_->stopped_postings;
+    filter.masked_bases = header_->masked_bases;
+    filter.total_bases = header_->total_bases;
+    filter.sampled_seeds = header_->sampled_seeds;
+    index_ = KmerIndex::view(
+        SeedShape::fromMask(header_->seed_mask, static_cast<int>(header_->seed_span)),
+        direct ? nullptr
+               : reinterpret_cast<const KmerKey*>(data_ + header_->keys_offset),
+        header_->num_keys,
+        reinterpret_cast<const uint64_t*>(data_ + header_->offsets_offset),
+        compressed ? nullptr : reinterpret_cast<const Posting*>(data_ + header_->postings_offset),
+        header_->num_postings, filter, static_cast<int>(header_->window),
+        compressed ? data_ + header_->postings_offset : nullptr, header_->block_bytes);
+    return true;
+}
+
+// Each sequence's name bytes, packed words and ambiguity runs must lie
+// inside their sections, and its runs inside the sequence
+bool MappedIndex::validRecords() const {
+    const SequenceRecord* records =
+        reinterpret_cast<const SequenceRecord*>(data_ + header_->records_offset);
+    const AmbiguityRun* runs =
+        reinterpret_cast<const AmbiguityRun*>(data_ + header_->runs_offset);
+    uint64_t name_bytes = header_->words_offset - header_->names_offset;
+    for (uint64_t sid = 0; sid < header_->num_sequences; ++sid) {
+        const SequenceRecord& record = records[sid];
+        if (record.name_offset > name_bytes ||
+            static_cast<uint64_t>(record.id_length) + record.species_length >
+                name_bytes - record.name_offset ||
+            record.seq_length > static_cast<uint64_t>(INT32_MAX) ||
+            record.word_offset > header_->num_words ||
+            packedWords(record.seq_length) > header_->num_words - record.word_offset ||
+            record.run_offset > header_->num_runs ||
+            record.num_runs > header_->num_runs - record.run_offset) {
+            return false;
+        }
+        for (uint64_t r = record.run_offset; r < record.run_offset + record.num_runs; ++r) {
+            if (static_cast<uint64_t>(runs[r].pos) + runs[r].len > record.seq_length) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Offsets must start at 0, never decrease, and end at the last posting
+// (or, compressed, at the padding after the last block), so no lookup
+// reads past the postings section. A hashed table also needs an empty
+// slot, or probing for an absent key would never stop.
+bool MappedIndex::validOffsets() const {
+    const uint64_t* offsets =
+        reinterpret_cast<const uint64_t*>(data_ + header_->offsets_offset);
+    uint64_t end = header_->compressed == 1
+        ? header_->block_bytes - POSTING_BLOCK_PADDING : header_->num_postings;
+    if (offsets[0] != 0 || offsets[header_->num_offsets - 1] != end) {
+        return false;
+    }
+    bool has_empty_slot = header_->layout == 0;
+    for (uint64_t i = 1; i < header_->num_offsets; ++i) {
+        if (offsets[i] < offsets[i - 1]) return false;
+        has_empty_slot = has_empty_slot || offsets[i] == offsets[i - 1];
+    }
+    return has_empty_slot;
+}
+
+void MappedIndex::close() {
+    if (data_ != nullptr) {
+        munmap(const_cast<unsigned char*>(data_), length_);
+    }
+    data_ = nullptr;
+    length_ = 0;
+    header_ = nullptr;
+    index_ = KmerIndex();
+}
+
+std::string_view MappedIndex::id(int sid) const {
+    const SequenceRecord& record = records_[sid];
+    return std::string_view(names_ + record.name_offset, record.id_length);
+}
+
+std::string_view MappedIndex::species(int sid) const {
+    const SequenceRecord& record = records_[sid];
+    return std::string_view(names_ + record.name_offset + record.id_length,
+                            record.species_length);
+}
+
+PackedView MappedIndex::seq(int sid) const {
+    const SequenceRecord& record = records_[sid];
+    PackedView view;
+    view.words = words_ + record.word_offset;
+    view.length = record.seq_length;
+    view.runs = runs_ + record.run_offset;
+    view.num_runs = record.num_runs;
+    return view;
+}
@@ -0,0 +1,115 @@
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "fasta.h"
+#include "index.h"
+
+// Binary index file written by --makedb and mapped read-only at search time.
+// Layout (host byte order, every section aligned to 8 bytes):
+//   IndexFileHeader
+//   SequenceRecord[num_sequences]
+//   name bytes        (id immediately followed by species, no terminators)
+//   uint64_t words[num_words]         (2-bit packed bases, see PackedSeq)
+//   AmbiguityRun runs[num_runs]
+//   KmerKey keys[num_keys]            (hashed layout only, see KmerIndex)
+//   uint64_t offsets[num_offsets]
+//   Posting postings[num_postings]    (or, compressed, uint8_t blocks[block_bytes])
+// The k-mer sections are the KmerIndex arrays verbatim, so a mapped file
+// is searched through a KmerIndex view without any conversion.
+const uint32_t INDEX_FILE_MAGIC = 0x58494253;  // "SBIX"
+const uint32_t INDEX_FILE_VERSION = 8;
+
+struct IndexFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t k;               // Seed weight
+    uint32_t layout;          // 0 for the direct layout, 1 for hashed
+    uint32_t seed_span;
+    uint32_t window;          // Minimizer window (1 = every seed)
+    uint32_t compressed;      // 1 when the postings are in blocks
+    uint32_t reserved;
+    uint64_t seed_mask;       // Bit i set for a '1' at position i of the seed
+    uint64_t max_postings;    // IndexFilterStats of the index
+    uint64_t stopped_kmers;
+    uint64_t stopped_postings;
+    uint64_t masked_bases;
+    uint64_t total_bases;
+    uint64_t sampled_seeds;
+    uint64_t num_sequences;
+    uint64_t num_words;
+    uint64_t num_runs;
+    uint64_t num_keys;
+    uint64_t num_offsets;
+    uint64_t num_postings;
+    uint64_t block_bytes;     // Compressed postings, padding included
+    uint64_t records_offset;
+    uint64_t names_offset;
+    uint64_t words_offset;
+    uint64_t runs_offset;
+    uint64_t keys_offset;
+    uint64_t offsets_offset;
+    uint64_t postings_offset;
+    uint64_t file_size;
+};
+
+struct SequenceRecord {
+    uint64_t name_offset;     // Offset of the id in the name bytes
+    uint32_t id_length;       // Species starts right after the id
+    uint32_t species_length;
+    uint64_t word_offset;     // First packed word (padding word included)
+    uint64_t seq_length;      // Bases
+    uint64_t run_offset;      // First ambiguity run
+    uint64_t num_runs;
+};
+
+// Write database sequences and their k-mer index to an index file
+// Returns false (after reporting the reason) if the file cannot be written
+bool writeIndexFile(const std::string& filename,
+                    const std::vector<Sequence>& database,
+                    const KmerIndex& index);
+
+// Read-only view of an index file mapped with mmap(MAP_SHARED), so
+// concurrent searches on the same host share one copy of the pages.
+// Opening validates the header, the section bounds, the sequence records
+// and the k-mer offsets; nothing is parsed or copied.
+class MappedIndex {
+public:
+    MappedIndex() = default;
+    ~MappedIndex();
+    MappedIndex(const MappedIndex&) = delete;
+    MappedIndex& operator=(const MappedIndex&) = delete;
+
+    // Map an index file; returns false (after reporting the reason) on error
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen() const { return data_ != nullptr; }
+
+    int k() const { return index_.k(); }
+    int size() const { return static_cast<int>(header_->num_sequences); }
+    std::string_view id(int sid) const;
+    std::string_view species(int sid) const;
+    PackedView seq(int sid) const;
+
+    // K-mer index whose arrays point into the mapping
+    const KmerIndex& index() const { return index_; }
+
+private:
+    bool validRecords() const;
+    bool validOffsets() const;
+
+    const unsigned char* data_ = nullptr;
+    size_t length_ = 0;
+    const IndexFileHeader* header_ = nullptr;
+    const SequenceRecord* records_ = nullptr;
+    const char* names_ = nullptr;
+    const uint64_t* words_ = nullptr;
+    const AmbiguityRun* runs_ = nullptr;
+    KmerIndex index_;
+};
+
+#endif // INDEXFILE_H
@@ -3,21 +3,68 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
-#include <sstream>
+#include <future>
+#include <unistd.h>
 #include "fasta.h"
 #include "index.h"
+#include "indexfile.h"
+#include "database.h"
 #include "search.h"
+#include "parallel.h"
+#include "dust.h"
+#include "output.h"
+#include "stats.h"
+#include "server.h"
+#include "engine.h"
 
 void printUsage(const char* program_name) {
     std::cerr << "Usage: " << program_name 
               << " --db <database.fasta> --query <query.fasta> [--k <kmer_size>] [--top <N>]"
               << std::endl;
+    std::cerr << "       " << program_name
+              << " --db <database.fasta> --makedb <index_file> [--k <kmer_size>]"
+              << std::endl;
+    std::cerr << "       " << program_name
+              << " --index <index_file> --query <query.fasta> [--top <N>]"
+              << std::endl;
+    std::cerr << "       " << program_name
+              << " --index <index_file> --serve <socket>"
+              << std::endl;
+    std::cerr << "       " << program_name
+              << " --client <socket> --query <query.fasta> [--top <N>] [--strand <S>] [--outfmt <F>]"
+              << std::endl;
     std::cerr << "Options:" << std::endl;
-    std::cerr << "  --db    : Database FASTA file (required)" << std::endl;
-    std::cerr << "  --query : Query FASTA file (required)" << std::endl;
-    std::cerr << "  --k     : K-mer size (default: 11)" << std::endl;
-    std::cerr << "  --top   : Number of top hits per query (default: 2, 0 = all)" << std::endl;
+    std::cerr << "  --db     : Database FASTA file" << std::endl;
+    std::cerr << "  --query  : Query FASTA file, or - for standard input" << std::endl;
+    std::cerr << "  --makedb : Write the database and its k-mer index to a file and exit" << std::endl;
+    std::cerr << "  --index  : Search an index file written by --makedb instead of --db" << std::endl;
+    std::cerr << "  --k      : K-mer size, 1 to 32 (default: 11)" << std::endl;
+    std::cerr << "  --seed   : Spaced seed pattern such as 111010010100110111 instead of --k" << std::endl;
+    std::cerr << "  --minimizer-window : Index only the minimizer of every window of this many seeds (default: 1 = every seed)" << std::endl;
+    std::cerr << "  --index-layout : auto, direct or hash (default: auto)" << std::endl;
+    std::cerr << "  --index-mem    : Largest direct k-mer table in MiB for auto (default: 128)" << std::endl;
+    std::cerr << "  --compress-postings : Store the index postings in compressed blocks, decoded as they are looked up" << std::endl;
+    std::cerr << "  --top    : Number of top hits per query (default: 2, 0 = all)" << std::endl;
+    std::cerr << "  --two-hit: Extend only after two seeds on one diagonal within this window (default: 0 = off)" << std::endl;
+    std::cerr << "  --gapped : Re-align HSPs with gaps (banded affine-gap X-drop)" << std::endl;
+    std::cerr << "  --gap-open    : Gap open penalty (default: 8)" << std::endl;
+    std::cerr << "  --gap-extend  : Gap extension penalty per base (default: 3)" << std::endl;
+    std::cerr << "  --gap-trigger : Ungapped score an HSP needs to be re-aligned (default: 30)" << std::endl;
+    std::cerr << "  --band        : Largest diagonal shift of a gapped alignment (default: 64)" << std::endl;
+    std::cerr << "  --strand : Query strands to search: plus, minus or both (default: plus)" << std::endl;
+    std::cerr << "  --outfmt : Report format: pretty, or tabular for one BLAST -outfmt 6 style line per hit (default: pretty)" << std::endl;
+    std::cerr << "  --dust   : Mask low-complexity regions of database and queries with DUST at this level, 20 is typical (default: 0 = off)" << std::endl;
+    std::cerr << "  --max-kmer-hits : Leave k-mers with more postings than this out of the index (default: 0 = no limit)" << std::endl;
+    std::cerr << "  --threads: Number of worker threads for building the index and searching (default: 1)" << std::endl;
+    std::cerr << "  --query-batch : MiB of query FASTA read and searched at a time (default: 16)" << std::endl;
+    std::cerr << "  --index-queries : Index each query batch and stream the database past it: auto, on or off (default: auto)" << std::endl;
+    std::cerr << "  --serve  : Keep the database and index loaded and answer queries on this Unix socket until stopped" << std::endl;
+    std::cerr << "  --client : Search --query on the server at this socket; only --top, --strand and --outfmt apply" << std::endl;
+    std::cerr << "  --stats  : Print stage times and counters as JSON to standard error at the end" << std::endl;
+    std::cerr << "  --stats-per-query : Also print one JSON line of counters per query" << std::endl;
 }
 
 // Format range string
@@ -25,33 +72,480 @@ std::string formatRange(int start, int end) {
     return std::to_string(start) + "-" + std::to_string(end);
 }
 
-// Wrap alignment lines to max 80 characters
-void printWrappedAlignment(const std::string& db_seq, const std::string& match_line, 
-                          const std::string& q_seq) {
+// Report how many bases DUST masked
+void printMasked(const char* what, uint64_t masked, uint64_t total) {
+    std::cerr << std::fixed << std::setprecision(2)
+              << "DUST: masked " << masked << " of " << total << " " << what << " bases ("
+              << (total > 0 ? 100.0 * static_cast<double>(masked) / static_cast<double>(total) : 0.0)
+              << "%)" << std::endl;
+    std::cerr.unsetf(std::ios::floatfield);
+    std::cerr << std::setprecision(6);
+}
+
+// Mask the low-complexity regions of every database sequence
+void dustDatabase(std::vector<Sequence>& database, const DustOptions& options, int threads) {
+    STATS_TIMER(Stage::Dust);
+    parallelFor(database.size(), threads, [&](size_t i, int) {
+        database[i].mask = dustMask(database[i].seq.view(), options);
+    });
+}
+
+// Report how long each phase of an index build took
+void printBuildStats(const IndexBuildStats& stats, const KmerIndex& index) {
+    std::cerr << std::fixed << std::setprecision(3)
+              << "Indexed " << index.numPostings() << " k-mers with "
+              << stats.threads << (stats.threads == 1 ? " thread" : " threads")
+              << " in " << stats.total_seconds << " s" << std::endl;
+    if (!index.isDirect()) {
+        std::cerr << "  keys:   " << stats.keys_seconds << " s" << std::endl;
+        std::cerr << "  table:  " << stats.table_seconds << " s" << std::endl;
+    }
+    std::cerr << "  count:  " << stats.count_seconds << " s" << std::endl;
+    std::cerr << "  prefix: " << stats.prefix_seconds << " s" << std::endl;
+    std::cerr << "  place:  " << stats.place_seconds << " s" << std::endl;
+    std::cerr.unsetf(std::ios::floatfield);
+    std::cerr << std::setprecision(6);
+}
+
+// Compress the postings of a freshly built index if asked to, and report
+// how small they got
+void compressIndex(KmerIndex& index, bool compress, int threads) {
+    if (!compress) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    index.compressPostings(threads);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double per_posting = index.numPostings() > 0
+        ? static_cast<double>(index.blockBytes()) / static_cast<double>(index.numPostings()) : 0.0;
+    std::cerr << std::fixed << std::setprecision(3)
+              << "Compressed " << index.numPostings() << " postings into " << index.blockBytes()
+              << " bytes (" << per_posting << " bytes per posting, " << sizeof(Posting)
+              << " uncompressed) in " << seconds << " s" << std::endl;
+    std::cerr.unsetf(std::ios::floatfield);
+    std::cerr << std::setprecision(6);
+}
+
+// Report what the stop list and DUST kept out of the index
+void printFilterStats(const IndexFilterStats& filter, bool dust) {
+    if (filter.max_postings > 0) {
+        std::cerr << "Stop list: dropped " << filter.stopped_kmers
+                  << " k-mers with more than " << filter.max_postings << " postings ("
+                  << filter.stopped_postings << " postings)" << std::endl;
+    }
+    if (dust || filter.masked_bases > 0) {
+        printMasked("database", filter.masked_bases, filter.total_bases);
+    }
+}
+
+// Report how many seeds a minimizer index kept, and the shortest match it
+// is still sure to seed
+void printSamplingStats(const KmerIndex& index) {
+    if (index.window() == 1) {
+        return;
+    }
+    const IndexFilterStats& filter = index.filterStats();
+    uint64_t kept = index.numPostings() + filter.stopped_postings;
+    uint64_t seeds = kept + filter.sampled_seeds;
+    std::cerr << std::fixed << std::setprecision(2)
+              << "Minimizers (w=" << index.window() << "): kept " << kept << " of " << seeds
+              << " seeds (" << (seeds > 0 ? 100.0 * static_cast<double>(kept) / static_cast<double>(seeds) : 0.0)
+              << "%); matches of " << index.guaranteedMatch() << "+ bases are sure to be seeded, "
+              << "against " << index.shape().span() << "+ with every seed" << std::endl;
+    std::cerr.unsetf(std::ios::floatfield);
+    std::cerr << std::setprecision(6);
+}
+
+// When to index the queries of a batch and stream the database past them,
+// instead of looking each query up in the database index (--index-queries)
+enum class QueryIndexing {
+    Auto,    // For a single small batch when the database index would be built
+    On,
+    Off
+};
+
+// Auto indexes the queries when they are all in one batch of at most this
+// fraction of the database's bases (counting both strands): indexing them
+// is then much cheaper than indexing the database. Larger batches search
+// faster with the database index.
+const double QUERY_INDEX_RATIO = 0.1;
+
+// Per-query state shared by the work items of its strands
+struct QuerySlot {
+    QueryWorkspace work;          // Reused by every query of the slot
+    std::atomic<int> done{0};     // Strands searched so far
+    RunStats stats[2];            // Recorded while searching each strand (--stats-per-query)
+};
+
+#ifndef BLASTN_NO_STATS
+// Adds what the calling thread records during its lifetime to *total
+// (nothing when total is null)
+class ThreadStatsDelta {
+public:
+    explicit ThreadStatsDelta(RunStats* total) : total_(total) {
+        if (total_) start_ = threadStats();
+    }
+    ~ThreadStatsDelta() {
+        if (total_) {
+            RunStats delta = threadStats();
+            delta -= start_;
+            *total_ += delta;
+        }
+    }
+    
+private:
+    RunStats* total_;
+    RunStats start_;
+};
+#endif
+
+// Parse the database FASTA, timed as its own stage
+std::vector<Sequence> parseDatabaseTimed(const FastaFile& fasta) {
+    STATS_TIMER(Stage::ParseDatabase);
+    return parseDatabase(fasta);
+}
+
+// Write an alignment as rows of at most 80 characters: database, match
+// and query lines, with a blank line between rows. Columns are rendered
+// straight into the output, one row at a time.
+void printWrappedAlignment(OutputBuffer& out, const PackedView& db_seq, const PackedView& query,
+                           const HSP& hsp, int q_start, int q_end) {
     const int MAX_LINE = 80;
     const int PREFIX_LEN = 6; // "DB:   " or "      " or "Q:   "
+    const size_t chunk_size = MAX_LINE - PREFIX_LEN;
+    
+    std::string db_line, match_line, q_line;
+    bool first_row = true;
+    auto printRow = [&]() {
+        if (!first_row) {
+            out << '\n';
+        }
+        out << "DB:   " << db_line << '\n';
+        out << "      " << match_line << '\n';
+        out << "Q:    " << q_line << '\n';
+        db_line.clear();
+        match_line.clear();
+        q_line.clear();
+        first_row = false;
+    };
+    forEachAlignmentColumn(db_seq, query, hsp.db_start, hsp.db_end, q_start, q_end, hsp.cigar,
+        [&](char db_base, char q_base) {
+            db_line += db_base;
+            match_line += isMatchColumn(db_base, q_base) ? '|' : ' ';
+            q_line += q_base;
+            if (db_line.size() == chunk_size) {
+                printRow();
+            }
+        });
+    if (!db_line.empty()) {
+        printRow();
+    }
+}
+
+// Write the report for one query: summary table of the top hits followed
+// by their alignments. query_minus is the query's reverse complement, used
+// for minus-strand hits, whose query range is printed from high to low.
+// Every report but the first is preceded by a blank line.
+void printQueryResult(OutputBuffer& out, const Query& query,
+                      const PackedView& query_minus,
+                      const std::vector<HSP>& merged_hsps,
+                      const DatabaseView& db, int top_n,
+                      bool show_strand, bool first) {
+    // Separator between queries
+    if (!first) {
+        out << '\n';
+    }
+    
+    if (merged_hsps.empty()) {
+        out << "QUERY: " << query.name << "   (" << query.seq.length() << " bp)\n";
+        out << '\n';
+        out << "BEST HIT: No hits found\n";
+        return;
+    }
+    
+    int display_count = (top_n == 0)
+        ? static_cast<int>(merged_hsps.size())
+        : std::min(top_n, static_cast<int>(merged_hsps.size()));
+    const HSP& best_hsp = merged_hsps[0];
+    
+    // Print headers
+    out << "QUERY: " << query.name << "   (" << query.seq.length() << " bp)\n";
+    out << '\n';
+    out << "BEST HIT: " << db.species(best_hsp.sid) << '\n';
+    out << '\n';
+    
+    // Print summary table
+    const std::string table_header =
+        "Species        Score   Identity   DB Range   Q Range";
+    out << table_header << '\n';
+    out << std::string(table_header.length(), '-') << '\n';
+    
+    for (int i = 0; i < display_count; ++i) {
+        const HSP& hsp = merged_hsps[i];
+        
+        // Truncate species name if too long
+        std::string species_display(db.species(hsp.sid));
+        if (species_display.length() > 14) {
+            species_display = species_display.substr(0, 11) + "...";
+        }
+        
+        OutputBuffer identity_text;
+        identity_text.fixed(hsp.identity, 2) << '%';
+        std::string db_range = formatRange(hsp.db_start, hsp.db_end);
+        std::string q_range = hsp.minus_strand ? formatRange(hsp.q_end, hsp.q_start)
+                                               : formatRange(hsp.q_start, hsp.q_end);
+        
+        out.padRight(species_display, 14);
+        out.padLeft(std::to_string(hsp.score), 7);
+        out.padLeft(identity_text.take(), 12);
+        out.padLeft(db_range, 11);
+        out.padLeft(q_range, 9) << '\n';
+    }
     
-    int chunk_size = MAX_LINE - PREFIX_LEN;
-    size_t len = db_seq.length();
+    out << '\n';
     
-    for (size_t i = 0; i < len; i += chunk_size) {
-        size_t end = std::min(i + chunk_size, len);
+    // Print alignment blocks
+    for (int i = 0; i < display_count; ++i) {
+        const HSP& hsp = merged_hsps[i];
+        
+        if (display_count > 1) {
+            out << "Hit #" << (i + 1) << " (" << db.species(hsp.sid) << ")\n";
+        }
+        
+        if (show_strand) {
+            out << "Strand: Plus/" << (hsp.minus_strand ? "Minus" : "Plus") << '\n';
+        }
+        if (!hsp.cigar.empty()) {
+            out << "CIGAR: " << hsp.cigar << '\n';
+        }
+        
+        // A minus-strand hit is shown against the reverse complement
+        int q_length = static_cast<int>(query.seq.length());
+        if (hsp.minus_strand) {
+            printWrappedAlignment(out, db.seq(hsp.sid), query_minus, hsp,
+                                  q_length - 1 - hsp.q_end, q_length - 1 - hsp.q_start);
+        } else {
+            printWrappedAlignment(out, db.seq(hsp.sid), query.seq.view(), hsp,
+                                  hsp.q_start, hsp.q_end);
+        }
         
-        std::cout << "DB:   " << db_seq.substr(i, end - i) << std::endl;
-        std::cout << "      " << match_line.substr(i, end - i) << std::endl;
-        std::cout << "Q:    " << q_seq.substr(i, end - i) << std::endl;
+        if (i < display_count - 1) {
+            out << '\n';
+        }
+    }
+}
+
+// First word of a FASTA name, as BLAST reports sequence IDs
+std::string_view firstWord(std::string_view name) {
+    size_t end = name.find_first_of(" \t");
+    return end == std::string_view::npos ? name : name.substr(0, end);
+}
+
+// Write one tab-separated line per hit, with the first ten columns of
+// BLAST -outfmt 6: query and database IDs, percent identity, alignment
+// length, mismatches, gap openings, then 1-based query and database
+// ranges (the database range runs backwards for minus-strand hits),
+// followed by the raw score. Alignment text is never rendered; only the
+// columns are counted.
+void printTabularResult(OutputBuffer& out, const Query& query,
+                        const PackedView& query_minus,
+                        const std::vector<HSP>& merged_hsps,
+                        const DatabaseView& db, int top_n) {
+    size_t display_count = top_n == 0
+        ? merged_hsps.size()
+        : std::min(static_cast<size_t>(top_n), merged_hsps.size());
+    int q_length = static_cast<int>(query.seq.length());
+    
+    for (size_t i = 0; i < display_count; ++i) {
+        const HSP& hsp = merged_hsps[i];
+        int length = 0, mismatches = 0, gap_opens = 0;
+        char previous_gap = 0;
+        auto count = [&](char db_base, char q_base) {
+            char gap = db_base == '-' ? 'I' : q_base == '-' ? 'D' : 0;
+            if (gap != 0 && gap != previous_gap) {
+                ++gap_opens;
+            } else if (gap == 0 && !isMatchColumn(db_base, q_base)) {
+                ++mismatches;
+            }
+            previous_gap = gap;
+            ++length;
+        };
+        if (hsp.minus_strand) {
+            forEachAlignmentColumn(db.seq(hsp.sid), query_minus, hsp.db_start, hsp.db_end,
+                                   q_length - 1 - hsp.q_end, q_length - 1 - hsp.q_start,
+                                   hsp.cigar, count);
+        } else {
+            forEachAlignmentColumn(db.seq(hsp.sid), query.seq.view(), hsp.db_start, hsp.db_end,
+                                   hsp.q_start, hsp.q_end, hsp.cigar, count);
+        }
         
-        if (end < len) {
-            std::cout << std::endl;
+        out << firstWord(query.name) << '\t' << firstWord(db.id(hsp.sid)) << '\t';
+        out.fixed(hsp.identity, 3) << '\t' << length << '\t' << mismatches << '\t'
+            << gap_opens << '\t' << (hsp.q_start + 1) << '\t' << (hsp.q_end + 1) << '\t';
+        if (hsp.minus_strand) {
+            out << (hsp.db_end + 1) << '\t' << (hsp.db_start + 1);
+        } else {
+            out << (hsp.db_start + 1) << '\t' << (hsp.db_end + 1);
         }
+        out << '\t' << hsp.score << '\n';
     }
 }
 
+// How queries are searched and reported against one database
+struct SearchSetup {
+    const SearchEngine* engine = nullptr;
+    QueryOptions query_options;
+    OutputFormat outfmt = OutputFormat::Pretty;
+    
+    // Totals of the queries' DUST masking, if they are counted
+    std::atomic<uint64_t>* query_bases = nullptr;
+    std::atomic<uint64_t>* query_masked = nullptr;
+    
+    size_t strands() const { return SearchEngine::strands(query_options); }
+};
+
+// Step 3: Search strand s of a query for HSPs, in the slot's workspace.
+// Returns true for the last of the query's strands to finish, which then
+// reports the query.
+bool searchStrand(const SearchSetup& setup, const Query& query, QuerySlot& slot, size_t s) {
+    setup.engine->searchStrand(query.seq, setup.query_options, slot.work, s);
+    if (s == 0 && setup.query_bases && setup.engine->dustOptions().level > 0) {
+        *setup.query_bases += query.seq.length();
+        *setup.query_masked += maskedBases(slot.work.mask[0]);
+    }
+    if (slot.done.fetch_add(1) + 1 < static_cast<int>(setup.strands())) {
+        return false;
+    }
+    slot.done = 0;
+    return true;
+}
+
+// Steps 4-6: Merge and rank the HSPs of every strand of a query, and write
+// its report. The first report of an output has no separator before it.
+void reportQuery(const SearchSetup& setup, const Query& query, QueryWorkspace& work,
+                 OutputBuffer& out, bool first) {
+    // Steps 4 and 5: Merge overlapping HSPs and keep the top hits, by
+    // score (descending), then by identity (descending)
+    const std::vector<HSP>& merged_hsps = setup.engine->collectHits(setup.query_options, work);
+    
+    // Step 6: Display results in compact format, or as a table
+    STATS_TIMER(Stage::Output);
+    const DatabaseView& db = setup.engine->database();
+    int top_n = setup.query_options.top_n;
+    if (setup.outfmt == OutputFormat::Tabular) {
+        printTabularResult(out, query, work.minus.view(), merged_hsps, db, top_n);
+    } else {
+        printQueryResult(out, query, work.minus.view(), merged_hsps, db, top_n,
+                         setup.query_options.strand != Strand::Plus, first);
+    }
+}
+
+// Apply the settings line of a server request ("outfmt=tabular top=5
+// strand=both", any of them) to setup. Returns false with a message in
+// error for an unknown or invalid setting.
+bool applyRequestSettings(std::string_view line, SearchSetup& setup, std::string& error) {
+    size_t pos = 0;
+    while (pos < line.size()) {
+        size_t end = line.find(' ', pos);
+        if (end == std::string_view::npos) end = line.size();
+        std::string_view setting = line.substr(pos, end - pos);
+        pos = end + 1;
+        if (setting.empty()) continue;
+        size_t eq = setting.find('=');
+        std::string_view key = setting.substr(0, eq);
+        std::string value(eq == std::string_view::npos ? std::string_view() : setting.substr(eq + 1));
+        if (key == "outfmt" && (value == "pretty" || value == "tabular")) {
+            setup.outfmt = value == "pretty" ? OutputFormat::Pretty : OutputFormat::Tabular;
+        } else if (key == "strand" && (value == "plus" || value == "minus" || value == "both")) {
+            setup.query_options.strand = value == "plus" ? Strand::Plus
+                         : value == "minus" ? Strand::Minus : Strand::Both;
+        } else if (key == "top" && !value.empty() &&
+                   value.find_first_not_of("0123456789") == std::string::npos && value.size() < 10) {
+            setup.query_options.top_n = std::stoi(value);
+        } else {
+            error = "Invalid setting " + std::string(setting);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Answer a server request: a settings line, then query FASTA. Queries are
+// searched one after the other on the calling worker, in its own slot.
+bool answerRequest(const SearchSetup& defaults, std::string_view request, QuerySlot& slot,
+                   std::string& response) {
+    size_t newline = request.find('\n');
+    if (newline == std::string_view::npos) {
+        response = "Request has no settings line";
+        return false;
+    }
+    SearchSetup setup = defaults;
+    if (!applyRequestSettings(request.substr(0, newline), setup, response)) {
+        return false;
+    }
+    std::vector<Query> queries = parseQueries(request.substr(newline + 1));
+    if (queries.empty()) {
+        response = "No queries found in request";
+        return false;
+    }
+    OutputBuffer out;
+    bool first = true;
+    for (const Query& query : queries) {
+        for (size_t s = 0; s < setup.strands(); ++s) {
+            searchStrand(setup, query, slot, s);
+        }
+        reportQuery(setup, query, slot.work, out, first);
+        first = false;
+    }
+    response = out.take();
+    return true;
+}
+
+// With --stats, print the statistics of the whole run as JSON
+void printRunStats(bool stats, std::chrono::steady_clock::time_point start,
+                   size_t index_bytes, int threads) {
+#ifndef BLASTN_NO_STATS
+    if (stats) {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printStatsJson(std::cerr, totalStats(), elapsed, index_bytes, threads);
+    }
+#else
+    (void)stats;
+    (void)start;
+    (void)index_bytes;
+    (void)threads;
+#endif
+}
+
 int main(int argc, char* argv[]) {
     std::string db_file;
     std::string query_file;
+    std::string makedb_file;
+    std::string index_file;
     int k = 11;
+    bool k_given = false;
+    std::string seed_pattern;
+    int minimizer_window = 1;  // 1 = index every seed
+    bool window_given = false;
+    bool compress_postings = false;
+    SearchOptions search_options;
+    IndexLayout layout = IndexLayout::Auto;
+    size_t direct_budget = DEFAULT_DIRECT_INDEX_BUDGET;
     int top_n = 2;  // Default to showing top 2 hits (0 = all)
+    int threads = 1;
+    size_t query_batch_mb = 16;
+    DustOptions dust_options;
+    dust_options.level = 0;  // Off unless --dust is given
+    uint64_t max_postings = 0;
+    Strand strand = Strand::Plus;
+    OutputFormat outfmt = OutputFormat::Pretty;
+    bool stats = false;
+    bool per_query_stats = false;
+    std::string serve_socket;
+    std::string client_socket;
+    std::string client_settings;  // --top, --strand and --outfmt as given, for the server
+    QueryIndexing query_indexing = QueryIndexing::Auto;
+    auto run_start = std::chrono::steady_clock::now();
     
     // Parse command-line arguments
     for (int i = 1; i < argc; ++i) {
@@ -61,170 +555,498 @@ int main(int argc, char* argv[]) {
             db_file = argv[++i];
         } else if (arg == "--query" && i + 1 < argc) {
             query_file = argv[++i];
+        } else if (arg == "--makedb" && i + 1 < argc) {
+            makedb_file = argv[++i];
+        } else if (arg == "--index" && i + 1 < argc) {
+            index_file = argv[++i];
         } else if (arg == "--k" && i + 1 < argc) {
             k = std::stoi(argv[++i]);
-            if (k < 1 || k > 16) {
-                std::cerr << "Error: k must be between 1 and 16" << std::endl;
+            k_given = true;
+            if (k < 1 || k > 32) {
+                std::cerr << "Error: k must be between 1 and 32" << std::endl;
                 return 1;
             }
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed_pattern = argv[++i];
+        } else if (arg == "--minimizer-window" && i + 1 < argc) {
+            minimizer_window = std::stoi(argv[++i]);
+            window_given = true;
+            if (minimizer_window < 1 || minimizer_window > MAX_MINIMIZER_WINDOW) {
+                std::cerr << "Error: minimizer-window must be between 1 and "
+                          << MAX_MINIMIZER_WINDOW << std::endl;
+                return 1;
+            }
+        } else if (arg == "--compress-postings") {
+            compress_postings = true;
+        } else if (arg == "--index-layout" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "auto") {
+                layout = IndexLayout::Auto;
+            } else if (value == "direct") {
+                layout = IndexLayout::Direct;
+            } else if (value == "hash") {
+                layout = IndexLayout::Hashed;
+            } else {
+                std::cerr << "Error: index-layout must be auto, direct or hash" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--index-mem" && i + 1 < argc) {
+            long long mib = std::stoll(argv[++i]);
+            if (mib < 0) {
+                std::cerr << "Error: index-mem must be non-negative" << std::endl;
+                return 1;
+            }
+            direct_budget = static_cast<size_t>(mib) << 20;
+        } else if (arg == "--strand" && i + 1 < argc) {
+            std::string value = argv[++i];
+            client_settings += " strand=" + value;
+            if (value == "plus") {
+                strand = Strand::Plus;
+            } else if (value == "minus") {
+                strand = Strand::Minus;
+            } else if (value == "both") {
+                strand = Strand::Both;
+            } else {
+                std::cerr << "Error: strand must be plus, minus or both" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--outfmt" && i + 1 < argc) {
+            std::string value = argv[++i];
+            client_settings += " outfmt=" + value;
+            if (value == "pretty") {
+                outfmt = OutputFormat::Pretty;
+            } else if (value == "tabular") {
+                outfmt = OutputFormat::Tabular;
+            } else {
+                std::cerr << "Error: outfmt must be pretty or tabular" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--gapped") {
+            search_options.gapped = true;
+        } else if ((arg == "--gap-open" || arg == "--gap-extend" ||
+                    arg == "--gap-trigger" || arg == "--band") && i + 1 < argc) {
+            int value = std::stoi(argv[++i]);
+            if (value < 0 || (arg == "--gap-extend" && value == 0)) {
+                std::cerr << "Error: " << arg.substr(2)
+                          << (arg == "--gap-extend" ? " must be positive" : " must be non-negative")
+                          << std::endl;
+                return 1;
+            }
+            GappedOptions& gapped = search_options.gapped_options;
+            if (arg == "--gap-open") gapped.gap_open = value;
+            else if (arg == "--gap-extend") gapped.gap_extend = value;
+            else if (arg == "--gap-trigger") gapped.trigger = value;
+            else gapped.band = value;
+        } else if (arg == "--two-hit" && i + 1 < argc) {
+            search_options.two_hit_window = std::stoi(argv[++i]);
+            if (search_options.two_hit_window < 0) {
+                std::cerr << "Error: two-hit window must be non-negative" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--dust" && i + 1 < argc) {
+            dust_options.level = std::stoi(argv[++i]);
+            if (dust_options.level < 0) {
+                std::cerr << "Error: dust level must be non-negative" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--max-kmer-hits" && i + 1 < argc) {
+            long long value = std::stoll(argv[++i]);
+            if (value < 0) {
+                std::cerr << "Error: max-kmer-hits must be non-negative" << std::endl;
+                return 1;
+            }
+            max_postings = static_cast<uint64_t>(value);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+            if (threads < 1) {
+                std::cerr << "Error: threads must be at least 1" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--query-batch" && i + 1 < argc) {
+            int value = std::stoi(argv[++i]);
+            if (value < 1) {
+                std::cerr << "Error: query-batch must be at least 1" << std::endl;
+                return 1;
+            }
+            query_batch_mb = static_cast<size_t>(value);
         } else if (arg == "--top" && i + 1 < argc) {
             top_n = std::stoi(argv[++i]);
             if (top_n < 0) {
                 std::cerr << "Error: top must be non-negative" << std::endl;
                 return 1;
             }
+            client_settings += " top=" + std::to_string(top_n);
+        } else if (arg == "--index-queries" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "auto") {
+                query_indexing = QueryIndexing::Auto;
+            } else if (value == "on") {
+                query_indexing = QueryIndexing::On;
+            } else if (value == "off") {
+                query_indexing = QueryIndexing::Off;
+            } else {
+                std::cerr << "Error: index-queries must be auto, on or off" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve_socket = argv[++i];
+        } else if (arg == "--client" && i + 1 < argc) {
+            client_socket = argv[++i];
+        } else if (arg == "--stats" || arg == "--stats-per-query") {
+            stats = true;
+            per_query_stats = per_query_stats || arg == "--stats-per-query";
         } else if (arg == "--help" || arg == "-h") {
             printUsage(argv[0]);
             return 0;
         }
     }
     
-    // Check required arguments
-    if (db_file.empty() || query_file.empty()) {
-        std::cerr << "Error: --db and --query are required" << std::endl;
-        printUsage(argv[0]);
+    // Client mode: send the queries to a server and print its report
+    if (!client_socket.empty()) {
+        if (query_file.empty()) {
+            std::cerr << "Error: --client requires --query" << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+        FastaFile query_fasta;
+        if (!query_fasta.open(query_file == "-" ? "/dev/stdin" : query_file, "query")) {
+            return 1;
+        }
+        std::string request = client_settings.empty() ? std::string() : client_settings.substr(1);
+        request += '\n';
+        request.append(query_fasta.data(), query_fasta.size());
+        std::string response;
+        bool ok = false;
+        if (!sendRequest(client_socket, request, response, &ok)) {
+            return 1;
+        }
+        if (!ok) {
+            std::cerr << "Error: " << response << std::endl;
+            return 1;
+        }
+        OutputBuffer out(STDOUT_FILENO);
+        out << response;
+        return 0;
+    }
+    
+#ifdef BLASTN_NO_STATS
+    if (stats) {
+        std::cerr << "Error: This build has no statistics (it was built with STATS=0)" << std::endl;
         return 1;
     }
+#else
+    if (stats) {
+        enableStats();
+    }
+#endif
     
-    // Step 1: Parse FASTA files
-    std::vector<Sequence> database = parseDatabase(db_file);
-    if (database.empty()) {
-        std::cerr << "Error: No sequences found in database file" << std::endl;
+    // Seed shape: the spaced seed if one was given, else k contiguous bases
+    SeedShape shape = SeedShape::contiguous(k);
+    if (!seed_pattern.empty()) {
+        if (!SeedShape::parse(seed_pattern, &shape)) {
+            return 1;
+        }
+        if (k_given && k != shape.weight()) {
+            std::cerr << "Error: k must equal the seed's weight (" << shape.weight()
+                      << ") when both are given" << std::endl;
+            return 1;
+        }
+    }
+    if (layout == IndexLayout::Direct && shape.weight() > MAX_DIRECT_K) {
+        std::cerr << "Error: The direct index layout supports k up to "
+                  << MAX_DIRECT_K << std::endl;
         return 1;
     }
     
-    std::vector<Query> queries = parseQueries(query_file);
-    if (queries.empty()) {
-        std::cerr << "Error: No queries found in query file" << std::endl;
+    // Index-building mode: parse and index the database once, then exit
+    if (!makedb_file.empty()) {
+        if (db_file.empty()) {
+            std::cerr << "Error: --makedb requires --db" << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+        FastaFile db_fasta;
+        if (!db_fasta.open(db_file, "database")) {
+            return 1;
+        }
+        std::vector<Sequence> database = parseDatabaseTimed(db_fasta);
+        if (database.empty()) {
+            std::cerr << "Error: No sequences found in database file" << std::endl;
+            return 1;
+        }
+        if (dust_options.level > 0) {
+            dustDatabase(database, dust_options, threads);
+        }
+        IndexBuildStats build_stats;
+        KmerIndex index;
+        {
+            STATS_TIMER(Stage::BuildIndex);
+            index = buildIndex(database, shape, layout, direct_budget, threads, &build_stats,
+                               max_postings, minimizer_window);
+        }
+        printBuildStats(build_stats, index);
+        {
+            STATS_TIMER(Stage::BuildIndex);
+            compressIndex(index, compress_postings, threads);
+        }
+        printFilterStats(index.filterStats(), dust_options.level > 0);
+        printSamplingStats(index);
+        bool written = writeIndexFile(makedb_file, database, index);
+        printRunStats(stats, run_start, index.memoryBytes(), threads);
+        return written ? 0 : 1;
+    }
+    
+    // Check required arguments
+    if ((db_file.empty() == index_file.empty()) || (query_file.empty() == serve_socket.empty())) {
+        std::cerr << "Error: exactly one of --db or --index, and one of --query or --serve, are required"
+                  << std::endl;
+        printUsage(argv[0]);
         return 1;
     }
     
-    // Step 2: Build k-mer index
-    KmerIndex index = buildIndex(database, k);
+    // Step 1: Load the database, either by mapping a prebuilt index file
+    // or by parsing the FASTA file
+    FastaFile db_fasta;
+    std::vector<Sequence> database;
+    MappedIndex mapped;
+    if (!index_file.empty()) {
+        STATS_TIMER(Stage::LoadIndex);
+        if (!mapped.open(index_file)) {
+            return 1;
+        }
+        const SeedShape& mapped_shape = mapped.index().shape();
+        if ((k_given || !seed_pattern.empty()) && shape != mapped_shape) {
+            if (shape.isContiguous() && mapped_shape.isContiguous()) {
+                std::cerr << "Error: Index file was built with k=" << mapped.k()
+                          << ", not " << k << std::endl;
+            } else {
+                std::cerr << "Error: Index file was built with seed " << mapped_shape.pattern()
+                          << ", not " << shape.pattern() << std::endl;
+            }
+            return 1;
+        }
+        if (compress_postings && !mapped.index().isCompressed()) {
+            std::cerr << "Error: Index file was built without --compress-postings" << std::endl;
+            return 1;
+        }
+        if (window_given && minimizer_window != mapped.index().window()) {
+            std::cerr << "Error: Index file was built with minimizer window "
+                      << mapped.index().window() << ", not " << minimizer_window << std::endl;
+            return 1;
+        }
+    } else {
+        if (!db_fasta.open(db_file, "database")) {
+            return 1;
+        }
+        database = parseDatabaseTimed(db_fasta);
+        if (database.empty()) {
+            std::cerr << "Error: No sequences found in database file" << std::endl;
+            return 1;
+        }
+    }
+    DatabaseView db = mapped.isOpen() ? DatabaseView(mapped) : DatabaseView(database);
     
-    // Process each query
-    for (size_t q_idx = 0; q_idx < queries.size(); ++q_idx) {
-        const Query& query = queries[q_idx];
-        
-        if (query.seq.empty()) {
-            std::cerr << "Warning: Query " << query.name << " is empty, skipping" << std::endl;
-            continue;
+    // Queries are streamed in batches; two are resident at a time, the one
+    // being searched and the one being read. A server reads none.
+    QueryReader reader;
+    QueryBatch batches[2];
+    auto read_batch = [&reader](QueryBatch& batch) {
+        STATS_TIMER(Stage::ReadQueries);
+        return reader.next(batch);
+    };
+    if (serve_socket.empty()) {
+        if (!reader.open(query_file, query_batch_mb << 20)) {
+            return 1;
         }
-        
-        // Step 3: Search for HSPs
-        std::vector<HSP> hsps = findHSPs(query.seq, database, index, k);
-        
-        // Step 4: Merge overlapping HSPs
-        std::vector<HSP> merged_hsps = mergeHSPs(hsps);
-        
-        // Step 5: Sort by score (descending), then by identity (descending)
-        std::sort(merged_hsps.begin(), merged_hsps.end(),
-            [](const HSP& a, const HSP& b) {
-                if (a.score != b.score) {
-                    return a.score > b.score;
-                }
-                return a.identity > b.identity;
-            });
-        
-        // Step 6: Display results in compact format
-        if (merged_hsps.empty()) {
-            std::cout << "QUERY: " << query.name << "   (" << query.seq.length()
-                      << " bp)" << std::endl;
-            std::cout << std::endl;
-            std::cout << "BEST HIT: No hits found" << std::endl;
-            if (q_idx < queries.size() - 1) {
-                std::cout << std::endl;
+        if (!read_batch(batches[0])) {
+            std::cerr << "Error: No queries found in query file" << std::endl;
+            return 1;
+        }
+    }
+    
+    // Query-batch indexing: index each batch of queries and stream the
+    // database past it. It needs the same seeds from the database as its
+    // index would give, so no stop list, and it reports no per-query
+    // search statistics.
+    bool index_queries = false;
+    if (query_indexing != QueryIndexing::Off) {
+        const char* conflict = nullptr;
+        if (!serve_socket.empty()) {
+            conflict = "--serve";
+        } else if (per_query_stats) {
+            conflict = "--stats-per-query";
+        } else if (mapped.isOpen() && !SearchEngine(db, mapped.index()).canSearchBatches()) {
+            conflict = "an index file built with a stop list, --dust or --minimizer-window";
+        } else if (!mapped.isOpen() && max_postings > 0) {
+            conflict = "--max-kmer-hits";
+        } else if (!mapped.isOpen() && minimizer_window > 1) {
+            conflict = "--minimizer-window";
+        }
+        if (query_indexing == QueryIndexing::On) {
+            if (conflict) {
+                std::cerr << "Error: --index-queries on cannot be used with " << conflict << std::endl;
+                return 1;
             }
-            continue;
+            index_queries = true;
+        } else if (!conflict && !mapped.isOpen() && reader.exhausted()) {
+            uint64_t batch_bases = 0, db_bases = 0;
+            for (const Query& query : batches[0].queries) batch_bases += query.seq.length();
+            for (int sid = 0; sid < db.size(); ++sid) db_bases += db.seq(sid).size();
+            batch_bases *= strand == Strand::Both ? 2 : 1;
+            index_queries = static_cast<double>(batch_bases) <=
+                            QUERY_INDEX_RATIO * static_cast<double>(db_bases);
         }
-        
-        int display_count = (top_n == 0)
-            ? static_cast<int>(merged_hsps.size())
-            : std::min(top_n, static_cast<int>(merged_hsps.size()));
-        const HSP& best_hsp = merged_hsps[0];
-        const Sequence& best_seq = database[best_hsp.sid];
-        
-        // Print headers
-        std::cout << "QUERY: " << query.name << "   (" << query.seq.length()
-                  << " bp)" << std::endl;
-        std::cout << std::endl;
-        std::cout << "BEST HIT: " << best_seq.species << std::endl;
-        std::cout << std::endl;
-        
-        // Print summary table
-        const std::string table_header =
-            "Species        Score   Identity   DB Range   Q Range";
-        std::cout << table_header << std::endl;
-        std::cout << std::string(table_header.length(), '-') << std::endl;
-        
-        for (int i = 0; i < display_count; ++i) {
-            const HSP& hsp = merged_hsps[i];
-            const Sequence& seq = database[hsp.sid];
-            
-            // Truncate species name if too long
-            std::string species_display = seq.species;
-            if (species_display.length() > 14) {
-                species_display = species_display.substr(0, 11) + "...";
-            }
-            
-            std::ostringstream identity_stream;
-            identity_stream << std::fixed << std::setprecision(2) << hsp.identity
-                            << "%";
-            std::string identity_str = identity_stream.str();
-            std::string db_range = formatRange(hsp.db_start, hsp.db_end);
-            std::string q_range = formatRange(hsp.q_start, hsp.q_end);
-            
-            std::cout << std::left << std::setw(14) << species_display;
-            std::cout << std::right << std::setw(7) << hsp.score;
-            std::cout << std::right << std::setw(12) << identity_str;
-            std::cout << std::right << std::setw(11) << db_range;
-            std::cout << std::right << std::setw(9) << q_range << std::endl;
-            std::cout << std::left;
+    }
+    
+    // Step 2: Build k-mer index (already present in a mapped index file,
+    // and not needed when the queries are indexed)
+    KmerIndex built_index;
+    if (!mapped.isOpen()) {
+        if (dust_options.level > 0) {
+            dustDatabase(database, dust_options, threads);
         }
+        if (index_queries) {
+            IndexFilterStats filter;
+            for (const Sequence& seq : database) {
+                filter.masked_bases += maskedBases(seq.mask);
+                filter.total_bases += seq.seq.length();
+            }
+            printFilterStats(filter, dust_options.level > 0);
+        } else {
+            STATS_TIMER(Stage::BuildIndex);
+            built_index = buildIndex(database, shape, layout, direct_budget, threads, nullptr,
+                                     max_postings, minimizer_window);
+            compressIndex(built_index, compress_postings, threads);
+            printFilterStats(built_index.filterStats(), dust_options.level > 0);
+            printSamplingStats(built_index);
+        }
+    } else {
+        printFilterStats(mapped.index().filterStats(), false);
+        printSamplingStats(mapped.index());
+    }
+    const KmerIndex& index = mapped.isOpen() ? mapped.index() : built_index;
+    std::atomic<uint64_t> query_bases{0}, query_masked{0};
+    SearchEngine engine = mapped.isOpen() || !index_queries
+        ? SearchEngine(db, index, search_options, dust_options)
+        : SearchEngine(db, shape, search_options, dust_options);
+    SearchSetup setup;
+    setup.engine = &engine;
+    setup.query_options.strand = strand;
+    setup.query_options.top_n = top_n;
+    setup.outfmt = outfmt;
+    
+    // Server mode: answer requests until stopped, each on one worker
+    if (!serve_socket.empty()) {
+        std::vector<QuerySlot> worker_slots(threads);
+        bool served = runServer(serve_socket, threads,
+            [&](std::string_view request, int worker, std::string& response) {
+                return answerRequest(setup, request, worker_slots[worker], response);
+            });
+        printRunStats(stats, run_start, index.memoryBytes(), threads);
+        return served ? 0 : 1;
+    }
+    setup.query_bases = &query_bases;
+    setup.query_masked = &query_masked;
+    
+    // Process queries on a pool of workers; results are printed strictly in
+    // input order, with at most a few queries per worker buffered. Each
+    // strand of a query is its own work item, so the two strands of one
+    // query can run concurrently; whichever finishes second reports both.
+    const size_t strands = setup.strands();
+    // One slot more than the claim window: while a query is emitted, and
+    // its --stats-per-query counters read, workers may already claim the
+    // query `window` items further on
+    const size_t window = 4 * static_cast<size_t>(threads) * strands;
+    std::vector<QuerySlot> slots(window + 1);
+    std::vector<QueryWorkspace> batch_work;  // One per query of a batch, when queries are indexed
+    size_t reported = 0;  // Queries of earlier batches
+    OutputBuffer results(STDOUT_FILENO);
+    for (int current = 0; ; current = 1 - current) {
+        const std::vector<Query>& queries = batches[current].queries;
         
-        std::cout << std::endl;
+        // Read the next batch while this one is searched
+        std::future<bool> next_batch = std::async(std::launch::async,
+            [&read_batch, &batches, current] { return read_batch(batches[1 - current]); });
         
-        // Print alignment blocks
-        for (int i = 0; i < display_count; ++i) {
-            const HSP& hsp = merged_hsps[i];
-            const Sequence& seq = database[hsp.sid];
-            
-            if (display_count > 1) {
-                std::cout << "Hit #" << (i + 1) << " (" << seq.species << ")"
-                          << std::endl;
-            }
-            
-            std::string alignment = getAlignment(
-                seq.seq, query.seq,
-                hsp.db_start, hsp.db_end,
-                hsp.q_start, hsp.q_end
-            );
-            
-            if (!alignment.empty()) {
-                size_t first_nl = alignment.find('\n');
-                size_t second_nl = alignment.find('\n', first_nl + 1);
-                if (first_nl != std::string::npos &&
-                    second_nl != std::string::npos) {
-                    std::string db_seq = alignment.substr(0, first_nl);
-                    std::string match_line =
-                        alignment.substr(first_nl + 1,
-                                         second_nl - first_nl - 1);
-                    std::string q_seq = alignment.substr(second_nl + 1);
-                    
-                    printWrappedAlignment(db_seq, match_line, q_seq);
+        // Query-batch indexing: search the whole batch, then report each
+        // query from its workspace
+        if (index_queries) {
+            engine.searchBatch(queries, setup.query_options, batch_work, threads);
+            for (size_t q_idx = 0; q_idx < queries.size(); ++q_idx) {
+                if (dust_options.level > 0) {
+                    query_bases += queries[q_idx].seq.length();
+                    query_masked += maskedBases(batch_work[q_idx].mask[0]);
                 }
             }
-            
-            if (i < display_count - 1) {
-                std::cout << std::endl;
-            }
+            orderedParallelFor(queries.size(), threads, window,
+                [&](size_t q_idx, int) -> std::string {
+                    OutputBuffer out;
+                    reportQuery(setup, queries[q_idx], batch_work[q_idx], out,
+                                reported + q_idx == 0);
+                    return out.take();
+                },
+                [&](size_t, std::string& text) {
+                    STATS_TIMER(Stage::Output);
+                    results << text;
+                });
+        } else {
+            orderedParallelFor(queries.size() * strands, threads, window,
+                [&](size_t item, int) -> std::string {
+                    size_t q_idx = item / strands;
+                    size_t s = item % strands;
+                    const Query& query = queries[q_idx];
+                    QuerySlot& slot = slots[q_idx % slots.size()];
+#ifndef BLASTN_NO_STATS
+                    ThreadStatsDelta query_stats(per_query_stats ? &slot.stats[s] : nullptr);
+#endif
+                    
+                    if (!searchStrand(setup, query, slot, s)) {
+                        return std::string();
+                    }
+                    OutputBuffer out;
+                    reportQuery(setup, query, slot.work, out, reported + q_idx == 0);
+                    return out.take();
+                },
+                [&](size_t item, std::string& text) {
+#ifndef BLASTN_NO_STATS
+                    if (per_query_stats && item % strands == strands - 1) {
+                        const Query& query = queries[item / strands];
+                        QuerySlot& slot = slots[(item / strands) % slots.size()];
+                        RunStats query_stats = slot.stats[0];
+                        if (strands == 2) query_stats += slot.stats[1];
+                        printQueryStatsJson(std::cerr, query.name, query_stats);
+                        slot.stats[0] = slot.stats[1] = RunStats();
+                    }
+#endif
+                    STATS_TIMER(Stage::Output);
+                    results << text;
+                });
         }
-        
-        // Add separator between queries
-        if (q_idx < queries.size() - 1) {
-            std::cout << std::endl;
+
+        // Emit the batch's reports now rather than once the buffer fills,
+        // so they do not wait on the next batch being read
+        bool written;
+        {
+            STATS_TIMER(Stage::Output);
+            written = results.flush();
+        }
+        if (!written) {
+            next_batch.get();
+            return 1;
+        }
+
+        reported += queries.size();
+        if (!next_batch.get()) {
+            break;
         }
     }
     
+    if (!results.flush()) {
+        return 1;
+    }
+    if (dust_options.level > 0) {
+        printMasked("query", query_masked, query_bases);
+    }
+    printRunStats(stats, run_start, index.memoryBytes(), threads);
     return 0;
 }
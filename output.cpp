@@ -0,0 +1,77 @@
+#include "output.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <iostream>
+#include <unistd.h>
+
+OutputBuffer::OutputBuffer(int fd, size_t flush_bytes)
+    : fd_(fd), flush_bytes_(flush_bytes) {
+    if (fd_ >= 0) text_.reserve(flush_bytes_ + flush_bytes_ / 4);
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+OutputBuffer& OutputBuffer::operator<<(int value) {
+    return *this << static_cast<int64_t>(value);
+}
+
+OutputBuffer& OutputBuffer::operator<<(int64_t value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    return *this << std::string_view(digits, static_cast<size_t>(result.ptr - digits));
+}
+
+OutputBuffer& OutputBuffer::operator<<(uint64_t value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    return *this << std::string_view(digits, static_cast<size_t>(result.ptr - digits));
+}
+
+OutputBuffer& OutputBuffer::fixed(double value, int decimals) {
+    char digits[64];
+    int length = std::snprintf(digits, sizeof(digits), "%.*f", decimals, value);
+    if (length < 0) return *this;
+    size_t used = std::min(static_cast<size_t>(length), sizeof(digits) - 1);
+    return *this << std::string_view(digits, used);
+}
+
+OutputBuffer& OutputBuffer::padRight(std::string_view text, size_t width) {
+    text_.append(text.data(), text.size());
+    if (text.size() < width) text_.append(width - text.size(), ' ');
+    flushIfFull();
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::padLeft(std::string_view text, size_t width) {
+    if (text.size() < width) text_.append(width - text.size(), ' ');
+    text_.append(text.data(), text.size());
+    flushIfFull();
+    return *this;
+}
+
+std::string OutputBuffer::take() {
+    std::string text;
+    text.swap(text_);
+    return text;
+}
+
+bool OutputBuffer::flush() {
+    if (fd_ < 0) return !failed_;
+    size_t written = 0;
+    while (!failed_ && written < text_.size()) {
+        ssize_t n = ::write(fd_, text_.data() + written, text_.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            std::cerr << "Error: Cannot write output" << std::endl;
+            failed_ = true;
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+    text_.clear();
+    return !failed_;
+}
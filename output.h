@@ -0,0 +1,70 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Report formats
+enum class OutputFormat {
+    Pretty,   // Summary table and wrapped alignments for each query
+    Tabular   // One tab-separated line per hit, like BLAST -outfmt 6
+};
+
+// Append-only text buffer for reports. Nothing is flushed per line: text
+// accumulates in one reusable string, and with a file descriptor it is
+// written out in large blocks once it holds flush_bytes, on flush() and
+// on destruction. Without one, take() hands the text over.
+class OutputBuffer {
+public:
+    static const size_t DEFAULT_FLUSH_BYTES = 1 << 20;
+
+    explicit OutputBuffer(int fd = -1, size_t flush_bytes = DEFAULT_FLUSH_BYTES);
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    OutputBuffer& operator<<(std::string_view text) {
+        text_.append(text.data(), text.size());
+        flushIfFull();
+        return *this;
+    }
+    OutputBuffer& operator<<(char c) {
+        text_.push_back(c);
+        flushIfFull();
+        return *this;
+    }
+    OutputBuffer& operator<<(int value);
+    OutputBuffer& operator<<(int64_t value);
+    OutputBuffer& operator<<(uint64_t value);
+
+    // value with a fixed number of decimals, rounded like printf
+    OutputBuffer& fixed(double value, int decimals);
+
+    // text padded with spaces to width, after it (padRight) or before it
+    OutputBuffer& padRight(std::string_view text, size_t width);
+    OutputBuffer& padLeft(std::string_view text, size_t width);
+
+    size_t size() const { return text_.size(); }
+
+    // Text buffered so far; the buffer is left empty
+    std::string take();
+
+    // Write the buffered text to the file descriptor. Returns false once a
+    // write has failed; later text is dropped.
+    bool flush();
+
+private:
+    void flushIfFull() {
+        if (fd_ >= 0 && text_.size() >= flush_bytes_) flush();
+    }
+
+    int fd_;
+    size_t flush_bytes_;
+    std::string text_;
+    bool failed_ = false;
+};
+
+#endif // OUTPUT_H
@@ -0,0 +1,201 @@
+#include "packed.h"
+#include <algorithm>
+#include <array>
+
+// 2-bit code of each letter, or 4 for anything that is not A/C/G/T
+static const unsigned char* codeTable() {
+    static const std::array<unsigned char, 256> table = [] {
+        std::array<unsigned char, 256> t;
+        t.fill(4);
+        t['A'] = 0; t['a'] = 0;
+        t['C'] = 1; t['c'] = 1;
+        t['G'] = 2; t['g'] = 2;
+        t['T'] = 3; t['t'] = 3;
+        return t;
+    }();
+    return table.data();
+}
+
+static const char BASE_LETTERS[4] = {'A', 'C', 'G', 'T'};
+
+void PackedSeq::append(char c) {
+    unsigned code = codeTable()[static_cast<unsigned char>(c)];
+    size_t word = length_ / BASES_PER_WORD;
+    if (words_.size() < word + 2) {
+        words_.push_back(0);
+    }
+    
+    if (code < 4) {
+        words_[word] |= static_cast<uint64_t>(code) << (62 - 2 * (length_ % BASES_PER_WORD));
+    } else {
+        // Ambiguous base: stored as A, remembered in a run
+        uint32_t base = static_cast<unsigned char>(
+            (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c);
+        uint32_t pos = static_cast<uint32_t>(length_);
+        if (!runs_.empty() && runs_.back().pos + runs_.back().len == pos &&
+            runs_.back().base == base) {
+            runs_.back().len++;
+        } else {
+            runs_.push_back({pos, 1, base});
+        }
+    }
+    
+    length_++;
+}
+
+// Bases are packed 32 at a time: the codes of a block are looked up and
+// OR-ed together, so one test validates the whole block, and the block is
+// written into the words with two shifts. Blocks holding anything other
+// than A/C/G/T go through append(char), which records the runs.
+void PackedSeq::append(const char* data, size_t len) {
+    words_.resize(packedWords(length_ + len), 0);
+    const unsigned char* table = codeTable();
+    for (size_t i = 0; i < len; ) {
+        size_t n = std::min<size_t>(BASES_PER_WORD, len - i);
+        uint64_t block = 0;
+        unsigned invalid = 0;
+        for (size_t j = 0; j < n; ++j) {
+            unsigned code = table[static_cast<unsigned char>(data[i + j])];
+            invalid |= code;
+            block = (block << 2) | (code & 3);
+        }
+        if (invalid & 4) {
+            for (size_t j = 0; j < n; ++j) {
+                append(data[i + j]);
+            }
+        } else {
+            block <<= 2 * (BASES_PER_WORD - n);
+            size_t word = length_ / BASES_PER_WORD;
+            unsigned shift = 2 * (length_ % BASES_PER_WORD);
+            words_[word] |= block >> shift;
+            if (shift != 0) {
+                words_[word + 1] |= block << (64 - shift);
+            }
+            length_ += n;
+        }
+        i += n;
+    }
+}
+
+// Complement of an IUPAC letter; letters without one map to themselves
+static uint32_t complementLetter(uint32_t base) {
+    switch (base) {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': return 'A';
+        case 'R': return 'Y';
+        case 'Y': return 'R';
+        case 'K': return 'M';
+        case 'M': return 'K';
+        case 'B': return 'V';
+        case 'V': return 'B';
+        case 'D': return 'H';
+        case 'H': return 'D';
+        default: return base;  // N, S, W and anything else
+    }
+}
+
+// Reverse the order of the 32 bases of a word
+static inline uint64_t reverseBases(uint64_t x) {
+    x = __builtin_bswap64(x);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((x & 0x0F0F0F0F0F0F0F0Full) << 4);
+    x = ((x >> 2) & 0x3333333333333333ull) | ((x & 0x3333333333333333ull) << 2);
+    return x;
+}
+
+// Word w of the result holds bases [32w, 32w + 32), which are the
+// complements of original bases length - 1 - 32w downwards: the reversed
+// 32-base window ending there. A=00/T=11 and C=01/G=10, so complementing
+// a code is inverting its bits.
+PackedSeq PackedSeq::reverseComplement() const {
+    PackedSeq rc;
+    reverseComplement(rc);
+    return rc;
+}
+
+void PackedSeq::reverseComplement(PackedSeq& rc) const {
+    rc.length_ = length_;
+    rc.runs_.clear();
+    rc.words_.assign(packedWords(length_), 0);
+    PackedView v = view();
+    for (size_t w = 0; w * BASES_PER_WORD < length_; ++w) {
+        size_t end = length_ - w * BASES_PER_WORD;  // One past the window's last base
+        uint64_t window = end >= BASES_PER_WORD
+            ? v.window(end - BASES_PER_WORD)
+            : v.window(0) >> (2 * (BASES_PER_WORD - end));
+        uint64_t word = ~reverseBases(window);
+        if (end < BASES_PER_WORD) {
+            word &= ~(~static_cast<uint64_t>(0) >> (2 * end));  // Zero past the end
+        }
+        rc.words_[w] = word;
+    }
+    
+    // Runs in reverse order, stored as A again like every ambiguous base
+    for (size_t r = runs_.size(); r-- > 0; ) {
+        const AmbiguityRun& run = runs_[r];
+        uint32_t pos = static_cast<uint32_t>(length_ - run.pos - run.len);
+        rc.runs_.push_back({pos, run.len, complementLetter(run.base)});
+        for (size_t i = pos; i < pos + run.len; ++i) {
+            rc.words_[i / BASES_PER_WORD] &= ~(static_cast<uint64_t>(3) << (62 - 2 * (i % BASES_PER_WORD)));
+        }
+    }
+}
+
+// First run that ends after pos (runs are sorted and disjoint)
+static const AmbiguityRun* firstRunAfter(const PackedView& seq, size_t pos) {
+    return std::upper_bound(seq.runs, seq.runs + seq.num_runs, pos,
+        [](size_t p, const AmbiguityRun& run) {
+            return p < static_cast<size_t>(run.pos) + run.len;
+        });
+}
+
+// Bases of window(i) covered by ambiguity runs
+uint64_t PackedView::ambiguityMask(size_t i) const {
+    if (num_runs == 0) return 0;
+    
+    uint64_t mask = 0;
+    const AmbiguityRun* end = runs + num_runs;
+    for (const AmbiguityRun* run = firstRunAfter(*this, i);
+         run != end && run->pos < i + BASES_PER_WORD; ++run) {
+        size_t first = std::max<size_t>(run->pos, i) - i;
+        size_t last = std::min<size_t>(static_cast<size_t>(run->pos) + run->len,
+                                       i + BASES_PER_WORD) - i;
+        for (size_t j = first; j < last; ++j) {
+            mask |= static_cast<uint64_t>(1) << (62 - 2 * j);
+        }
+    }
+    return mask;
+}
+
+// Original letter of base i
+char PackedView::at(size_t i) const {
+    if (num_runs > 0) {
+        const AmbiguityRun* run = firstRunAfter(*this, i);
+        if (run != runs + num_runs && run->pos <= i) {
+            return static_cast<char>(run->base);
+        }
+    }
+    return BASE_LETTERS[code(i)];
+}
+
+// Decode bases [pos, pos + len) back to letters
+std::string PackedView::substr(size_t pos, size_t len) const {
+    len = std::min(len, length - std::min(pos, length));
+    std::string out(len, 'A');
+    for (size_t j = 0; j < len; ++j) {
+        out[j] = BASE_LETTERS[code(pos + j)];
+    }
+    
+    // Restore the ambiguous letters
+    const AmbiguityRun* end = runs + num_runs;
+    for (const AmbiguityRun* run = num_runs ? firstRunAfter(*this, pos) : end;
+         run != end && run->pos < pos + len; ++run) {
+        size_t first = std::max<size_t>(run->pos, pos);
+        size_t last = std::min<size_t>(static_cast<size_t>(run->pos) + run->len, pos + len);
+        for (size_t j = first; j < last; ++j) {
+            out[j - pos] = static_cast<char>(run->base);
+        }
+    }
+    return out;
+}
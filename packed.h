@@ -0,0 +1,127 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 2-bit nucleotide codes: A=00, C=01, G=10, T=11
+// Base i of a packed sequence lives in word i / 32, most significant bits
+// first, so the 2k bits starting at base i read as encodeKmer() would
+// encode the same k bases.
+const int BASES_PER_WORD = 32;
+
+// Run of identical non-ACGT bases (N or another IUPAC code) at
+// [pos, pos + len). Ambiguous bases are stored as A in the packed words;
+// the runs are kept sorted by position.
+struct AmbiguityRun {
+    uint32_t pos;
+    uint32_t len;
+    uint32_t base;            // Original (uppercase) letter
+};
+
+// Interval [pos, pos + len) of bases excluded from seeding, such as a
+// low-complexity region; the bases themselves are kept and can still be
+// aligned. Lists of them are kept sorted by position.
+struct MaskInterval {
+    uint32_t pos;
+    uint32_t len;
+};
+
+// Read-only view of a packed sequence; the words always include one
+// zero word of padding past the last base so windows never need a
+// bounds check
+struct PackedView {
+    const uint64_t* words = nullptr;
+    size_t length = 0;
+    const AmbiguityRun* runs = nullptr;
+    size_t num_runs = 0;
+
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+    // 2-bit code of base i
+    unsigned code(size_t i) const {
+        return static_cast<unsigned>(words[i / BASES_PER_WORD] >>
+                                     (62 - 2 * (i % BASES_PER_WORD))) & 3;
+    }
+
+    // 32 bases starting at base i, base i in the top two bits
+    // Bases past the end of the sequence read as A
+    uint64_t window(size_t i) const {
+        size_t word = i / BASES_PER_WORD;
+        unsigned shift = 2 * (i % BASES_PER_WORD);
+        if (shift == 0) return words[word];
+        return (words[word] << shift) | (words[word + 1] >> (64 - shift));
+    }
+
+    // Bases of window(i) covered by ambiguity runs, one bit per base in the
+    // low bit of the base's 2-bit field
+    uint64_t ambiguityMask(size_t i) const;
+
+    // Original letter of base i
+    char at(size_t i) const;
+
+    // Decode bases [pos, pos + len) back to letters
+    std::string substr(size_t pos, size_t len) const;
+};
+
+// Number of words a packed sequence of length bases occupies, padding included
+inline size_t packedWords(size_t length) {
+    return (length + BASES_PER_WORD - 1) / BASES_PER_WORD + 1;
+}
+
+// Owning 2-bit packed DNA sequence, built one base or one line at a time
+class PackedSeq {
+public:
+    PackedSeq() : words_(1, 0) {}
+
+    // Append bases; lowercase letters are uppercased and anything other
+    // than A/C/G/T is recorded as an ambiguity run
+    void append(char c);
+    void append(const char* data, size_t len);
+    void append(const std::string& bases) { append(bases.data(), bases.size()); }
+
+    // Make room for a sequence of the given length without reallocating
+    void reserve(size_t bases) { words_.reserve(packedWords(bases)); }
+
+    size_t length() const { return length_; }
+    bool empty() const { return length_ == 0; }
+
+    PackedView view() const {
+        PackedView v;
+        v.words = words_.data();
+        v.length = length_;
+        v.runs = runs_.data();
+        v.num_runs = runs_.size();
+        return v;
+    }
+
+    std::string toString() const { return view().substr(0, length_); }
+
+    // Reverse complement, computed a word at a time from the packed bases;
+    // ambiguity runs keep their IUPAC complement (N stays N, R becomes Y...)
+    PackedSeq reverseComplement() const;
+
+    // Same, into rc, reusing its storage
+    void reverseComplement(PackedSeq& rc) const;
+
+    // Storage, for writing to an index file
+    const std::vector<uint64_t>& words() const { return words_; }
+    const std::vector<AmbiguityRun>& runs() const { return runs_; }
+
+private:
+    std::vector<uint64_t> words_;     // Includes the zero padding word
+    std::vector<AmbiguityRun> runs_;
+    size_t length_ = 0;
+};
+
+// Mismatching bases between two 32-base windows, one bit per base in the
+// low bit of the base's 2-bit field (same positions as ambiguityMask)
+inline uint64_t mismatchBits(uint64_t a, uint64_t b) {
+    uint64_t diff = a ^ b;
+    return (diff | (diff >> 1)) & 0x5555555555555555ull;
+}
+
+#endif // PACKED_H
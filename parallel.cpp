@@ -0,0 +1,98 @@
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Run work(i, worker) for every i in [0, count) on a pool of workers
+void parallelFor(size_t count, int threads,
+                 const std::function<void(size_t, int)>& work) {
+    if (threads <= 1 || count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            work(i, 0);
+        }
+        return;
+    }
+    
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    int workers = static_cast<int>(std::min<size_t>(threads, count));
+    for (int w = 0; w < workers; ++w) {
+        pool.emplace_back([&, w]() {
+            for (size_t i = next++; i < count; i = next++) {
+                work(i, w);
+            }
+        });
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+}
+
+// Run work on a pool of workers and emit results in index order
+void orderedParallelFor(size_t count, int threads, size_t window,
+                        const std::function<std::string(size_t, int)>& work,
+                        const std::function<void(size_t, std::string&)>& emit) {
+    if (threads <= 1 || count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            std::string text = work(i, 0);
+            emit(i, text);
+        }
+        return;
+    }
+    
+    window = std::max<size_t>(window, 1);
+    std::vector<std::string> slots(window);
+    std::vector<char> ready(window, 0);
+    size_t next_claim = 0;   // Next item a worker may take
+    size_t next_emit = 0;    // Next item to hand to emit
+    std::mutex mutex;
+    std::condition_variable can_claim;
+    std::condition_variable can_emit;
+    
+    std::vector<std::thread> pool;
+    int workers = static_cast<int>(std::min<size_t>(threads, count));
+    for (int w = 0; w < workers; ++w) {
+        pool.emplace_back([&, w]() {
+            while (true) {
+                size_t i;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    can_claim.wait(lock, [&] {
+                        return next_claim >= count || next_claim < next_emit + window;
+                    });
+                    if (next_claim >= count) return;
+                    i = next_claim++;
+                }
+                
+                std::string text = work(i, w);
+                
+                std::lock_guard<std::mutex> lock(mutex);
+                slots[i % window] = std::move(text);
+                ready[i % window] = 1;
+                if (i == next_emit) {
+                    can_emit.notify_one();
+                }
+            }
+        });
+    }
+    
+    for (size_t i = 0; i < count; ++i) {
+        std::string text;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            can_emit.wait(lock, [&] { return ready[i % window] != 0; });
+            text.swap(slots[i % window]);
+            ready[i % window] = 0;
+            next_emit = i + 1;
+        }
+        can_claim.notify_all();
+        emit(i, text);
+    }
+    
+    for (auto& t : pool) {
+        t.join();
+    }
+}
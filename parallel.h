@@ -0,0 +1,24 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// Run work(i, worker) for every i in [0, count) on `threads` worker
+// threads (worker is in [0, threads)). Workers claim indices one at a time
+// from a shared counter, so uneven items balance themselves.
+// With threads <= 1 everything runs on the calling thread.
+void parallelFor(size_t count, int threads,
+                 const std::function<void(size_t, int)>& work);
+
+// Like parallelFor, but each item produces text that is passed to
+// emit(i, text) on the calling thread strictly in index order.
+// Workers never run more than `window` items ahead of the next item to
+// emit, so at most `window` results are buffered at any time. While
+// emit(i, text) runs, workers may already be on items up to i + window.
+void orderedParallelFor(size_t count, int threads, size_t window,
+                        const std::function<std::string(size_t, int)>& work,
+                        const std::function<void(size_t, std::string&)>& emit);
+
+#endif // PARALLEL_H
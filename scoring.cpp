@@ -2,126 +2,377 @@
 #include <algorithm>
 #include <cmath>
 
-// Perform ungapped extension from a seed position
-// Match: +2, Mismatch: -1
-// Extends both left and right from seed
-ExtensionResult extendUngapped(
-    const std::string& db_seq,
-    const std::string& query,
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCORING_X86 1
+#endif
+
+// Score drop below the best score at which an extension stops
+static const int X_DROP = 20;
+
+// Mask selecting the first n bases of a 32-base window
+static inline uint64_t leadingBases(size_t n) {
+    return n >= BASES_PER_WORD ? ~static_cast<uint64_t>(0)
+                               : ~(~static_cast<uint64_t>(0) >> (2 * n));
+}
+
+// Bases of the two windows that do not match, ambiguous bases included
+static inline uint64_t windowMismatches(const PackedView& db_seq, size_t db_pos,
+                                        const PackedView& query, size_t q_pos) {
+    return mismatchBits(db_seq.window(db_pos), query.window(q_pos)) |
+           db_seq.ambiguityMask(db_pos) | query.ambiguityMask(q_pos);
+}
+
+// Running state of a one-directional X-drop extension. Mismatches are
+// visited in extension order; the matches between them are added as a run.
+struct XDropState {
+    int score = 0;
+    int best_score = 0;
+    size_t best_length = 0;   // Bases from the seed to the best end point
+    size_t matched = 0;
+    size_t best_matched = 0;  // Matches up to the best end point
+
+    // Add a run of matches ending after `length` bases
+    void matches(size_t run, size_t length) {
+        if (run == 0) return;
+        score += 2 * static_cast<int>(run);
+        matched += run;
+        if (score > best_score) {
+            best_score = score;
+            best_length = length;
+            best_matched = matched;
+        }
+    }
+
+    // Add a mismatch; returns false once the score has dropped too far
+    bool mismatch() {
+        score -= 1;
+        return score >= best_score - X_DROP;
+    }
+
+    // Scan n bases of a window moving right; window base j (bit 62 - 2j)
+    // is `done + j` bases past the seed. Returns false on an X-drop.
+    bool scanRight(uint64_t mism, size_t n, size_t done) {
+        size_t next = 0;  // Next unvisited base of the window
+        while (mism != 0) {
+            size_t j = static_cast<size_t>(__builtin_clzll(mism)) / 2;
+            matches(j - next, done + j);
+            if (!mismatch()) return false;
+            next = j + 1;
+            mism &= ~(static_cast<uint64_t>(1) << (62 - 2 * j));
+        }
+        matches(n - next, done + n);
+        return true;
+    }
+
+    // Scan the first n bases of a window moving left; window base n - 1 - t
+    // is step t. Returns false on an X-drop.
+    bool scanLeft(uint64_t mism, size_t n, size_t done) {
+        size_t next = 0;
+        while (mism != 0) {
+            size_t bit = static_cast<size_t>(__builtin_ctzll(mism));
+            size_t t = n - 1 - (62 - bit) / 2;
+            matches(t - next, done + t);
+            if (!mismatch()) return false;
+            next = t + 1;
+            mism &= mism - 1;
+        }
+        matches(n - next, done + n);
+        return true;
+    }
+};
+
+// Mismatch masks for LANES consecutive 32-base windows at once. Each
+// block computes masks[l] for the windows starting at base 32 * l past
+// db_pos / q_pos and returns whether any of them is nonzero. Callers only
+// use a block when LANES * 32 bases remain in both sequences, so the
+// extra word the SIMD loads read is always inside the padded storage.
+struct ScalarBlock {
+    static const size_t LANES = 1;
+
+    bool operator()(const PackedView& db_seq, size_t db_pos,
+                    const PackedView& query, size_t q_pos, uint64_t* masks) const {
+        masks[0] = mismatchBits(db_seq.window(db_pos), query.window(q_pos));
+        return masks[0] != 0;
+    }
+};
+
+#ifdef SCORING_X86
+struct Sse42Block {
+    static const size_t LANES = 2;
+
+    // Two windows: (words[j + l] << s) | (words[j + l + 1] >> (64 - s))
+    __attribute__((target("sse4.2")))
+    static inline __m128i windows(const PackedView& seq, size_t pos) {
+        const uint64_t* words = seq.words + pos / BASES_PER_WORD;
+        int shift = static_cast<int>(2 * (pos % BASES_PER_WORD));
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + 1));
+        // A shift count of 64 yields zero, which covers shift == 0
+        return _mm_or_si128(_mm_sll_epi64(lo, _mm_cvtsi32_si128(shift)),
+                            _mm_srl_epi64(hi, _mm_cvtsi32_si128(64 - shift)));
+    }
+
+    __attribute__((target("sse4.2")))
+    inline bool operator()(const PackedView& db_seq, size_t db_pos,
+                           const PackedView& query, size_t q_pos, uint64_t* masks) const {
+        __m128i diff = _mm_xor_si128(windows(db_seq, db_pos), windows(query, q_pos));
+        __m128i mism = _mm_and_si128(_mm_or_si128(diff, _mm_srli_epi64(diff, 1)),
+                                     _mm_set1_epi64x(0x5555555555555555ll));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(masks), mism);
+        return !_mm_testz_si128(mism, mism);
+    }
+};
+
+struct Avx2Block {
+    static const size_t LANES = 4;
+
+    __attribute__((target("avx2")))
+    static inline __m256i windows(const PackedView& seq, size_t pos) {
+        const uint64_t* words = seq.words + pos / BASES_PER_WORD;
+        int shift = static_cast<int>(2 * (pos % BASES_PER_WORD));
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + 1));
+        return _mm256_or_si256(_mm256_sll_epi64(lo, _mm_cvtsi32_si128(shift)),
+                               _mm256_srl_epi64(hi, _mm_cvtsi32_si128(64 - shift)));
+    }
+
+    __attribute__((target("avx2")))
+    inline bool operator()(const PackedView& db_seq, size_t db_pos,
+                           const PackedView& query, size_t q_pos, uint64_t* masks) const {
+        __m256i diff = _mm256_xor_si256(windows(db_seq, db_pos), windows(query, q_pos));
+        __m256i mism = _mm256_and_si256(_mm256_or_si256(diff, _mm256_srli_epi64(diff, 1)),
+                                        _mm256_set1_epi64x(0x5555555555555555ll));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(masks), mism);
+        return !_mm256_testz_si256(mism, mism);
+    }
+};
+#endif
+
+// Single-pass ungapped X-drop extension. Whole blocks of Block::LANES
+// windows are compared at once; an all-match block is added in one step
+// and only blocks with mismatches are scanned window by window.
+// The entry points below are flattened so the kernel and its block are
+// inlined into one function compiled for the block's instruction set.
+template <typename Block>
+static inline ExtensionResult extendKernel(
+    const PackedView& db_seq,
+    const PackedView& query,
     int db_seed_pos,
     int q_seed_pos
 ) {
-    ExtensionResult result;
-    
-    int db_len = static_cast<int>(db_seq.length());
-    int q_len = static_cast<int>(query.length());
-    
-    // Start from seed position (k-mer match, so initial score is k*2)
-    // For simplicity, we'll extend and calculate score from scratch
-    
-    // Extend to the right
-    int db_pos = db_seed_pos;
-    int q_pos = q_seed_pos;
-    int right_score = 0;
-    int best_right_score = 0;
-    int best_right_end_db = db_seed_pos;
-    int best_right_end_q = q_seed_pos;
-    
-    // Extend right until we can't extend further or score drops too much
-    while (db_pos + 1 < db_len && q_pos + 1 < q_len) {
-        db_pos++;
-        q_pos++;
-        
-        if (db_seq[db_pos] == query[q_pos]) {
-            right_score += 2;  // Match
-        } else {
-            right_score -= 1;  // Mismatch
+    const size_t LANES = Block::LANES;
+    const size_t BLOCK = LANES * BASES_PER_WORD;
+    const bool ambiguous = db_seq.num_runs != 0 || query.num_runs != 0;
+    Block block;
+    uint64_t masks[LANES];
+
+    size_t db_seed = static_cast<size_t>(db_seed_pos);
+    size_t q_seed = static_cast<size_t>(q_seed_pos);
+
+    // Extend to the right, starting one base past the seed
+    XDropState right;
+    size_t right_max = std::min(db_seq.size() - db_seed, query.size() - q_seed) - 1;
+    size_t done = 0;
+    bool dropped = false;
+    while (!dropped && right_max - done >= BLOCK) {
+        size_t db_pos = db_seed + 1 + done;
+        size_t q_pos = q_seed + 1 + done;
+        bool any = block(db_seq, db_pos, query, q_pos, masks);
+        if (ambiguous) {
+            for (size_t l = 0; l < LANES; ++l) {
+                masks[l] |= db_seq.ambiguityMask(db_pos + l * BASES_PER_WORD) |
+                            query.ambiguityMask(q_pos + l * BASES_PER_WORD);
+                any = any || masks[l] != 0;
+            }
         }
-        
-        // Keep track of best cumulative score
-        if (right_score > best_right_score) {
-            best_right_score = right_score;
-            best_right_end_db = db_pos;
-            best_right_end_q = q_pos;
+        if (!any) {
+            right.matches(BLOCK, done + BLOCK);
+            done += BLOCK;
+            continue;
         }
-        
-        // Stop if score becomes too negative (drop threshold)
-        // This prevents extending through very poor regions
-        if (right_score < best_right_score - 20) {
-            break;
+        for (size_t l = 0; l < LANES && !dropped; ++l) {
+            dropped = !right.scanRight(masks[l], BASES_PER_WORD, done);
+            done += BASES_PER_WORD;
         }
     }
-    
-    // Extend to the left
-    int left_score = 0;
-    int best_left_score = 0;
-    int best_left_start_db = db_seed_pos;
-    int best_left_start_q = q_seed_pos;
-    
-    db_pos = db_seed_pos;
-    q_pos = q_seed_pos;
-    
-    while (db_pos > 0 && q_pos > 0) {
-        db_pos--;
-        q_pos--;
-        
-        if (db_seq[db_pos] == query[q_pos]) {
-            left_score += 2;  // Match
-        } else {
-            left_score -= 1;  // Mismatch
+    while (!dropped && done < right_max) {
+        size_t n = std::min<size_t>(BASES_PER_WORD, right_max - done);
+        uint64_t mism = windowMismatches(db_seq, db_seed + 1 + done,
+                                         query, q_seed + 1 + done) & leadingBases(n);
+        dropped = !right.scanRight(mism, n, done);
+        done += n;
+    }
+
+    // Extend to the left, starting one base before the seed; a block covers
+    // the BLOCK bases just left of what has been scanned so far
+    XDropState left;
+    size_t left_max = std::min(db_seed, q_seed);
+    done = 0;
+    dropped = false;
+    while (!dropped && left_max - done >= BLOCK) {
+        size_t db_pos = db_seed - done - BLOCK;
+        size_t q_pos = q_seed - done - BLOCK;
+        bool any = block(db_seq, db_pos, query, q_pos, masks);
+        if (ambiguous) {
+            for (size_t l = 0; l < LANES; ++l) {
+                masks[l] |= db_seq.ambiguityMask(db_pos + l * BASES_PER_WORD) |
+                            query.ambiguityMask(q_pos + l * BASES_PER_WORD);
+                any = any || masks[l] != 0;
+            }
         }
-        
-        // Keep track of best cumulative score
-        if (left_score > best_left_score) {
-            best_left_score = left_score;
-            best_left_start_db = db_pos;
-            best_left_start_q = q_pos;
+        if (!any) {
+            left.matches(BLOCK, done + BLOCK);
+            done += BLOCK;
+            continue;
         }
-        
-        // Stop if score becomes too negative
-        if (left_score < best_left_score - 20) {
-            break;
+        for (size_t l = LANES; l-- > 0 && !dropped; ) {
+            dropped = !left.scanLeft(masks[l], BASES_PER_WORD, done);
+            done += BASES_PER_WORD;
         }
     }
-    
-    // Combine left and right extensions
-    // The total score is left_score + right_score (seed position counted once in each)
-    // But since we're extending from seed, we need to account for the seed itself
-    // For simplicity, we'll recalculate the full alignment score
-    result.db_start = best_left_start_db;
-    result.db_end = best_right_end_db;
-    result.q_start = best_left_start_q;
-    result.q_end = best_right_end_q;
-    
-    // Recalculate total score for the entire alignment
-    int total_score = 0;
-    db_pos = result.db_start;
-    q_pos = result.q_start;
-    while (db_pos <= result.db_end && q_pos <= result.q_end) {
-        if (db_seq[db_pos] == query[q_pos]) {
-            total_score += 2;
-        } else {
-            total_score -= 1;
-        }
-        db_pos++;
-        q_pos++;
-    }
-    result.score = total_score;
-    
-    // Calculate percent identity
-    result.identity = calculateIdentity(
-        db_seq, query,
-        result.db_start, result.db_end,
-        result.q_start, result.q_end
-    );
-    
+    while (!dropped && done < left_max) {
+        size_t n = std::min<size_t>(BASES_PER_WORD, left_max - done);
+        uint64_t mism = windowMismatches(db_seq, db_seed - done - n,
+                                         query, q_seed - done - n) & leadingBases(n);
+        dropped = !left.scanLeft(mism, n, done);
+        done += n;
+    }
+
+    ExtensionResult result;
+    result.db_start = db_seed_pos - static_cast<int>(left.best_length);
+    result.db_end = db_seed_pos + static_cast<int>(right.best_length);
+    result.q_start = q_seed_pos - static_cast<int>(left.best_length);
+    result.q_end = q_seed_pos + static_cast<int>(right.best_length);
+
+    // Score and identity of the whole alignment come straight from the two
+    // scans plus the seed base itself; nothing is re-read
+    bool seed_match = (windowMismatches(db_seq, db_seed, query, q_seed) &
+                       leadingBases(1)) == 0;
+    size_t length = left.best_length + right.best_length + 1;
+    size_t matches = left.best_matched + right.best_matched + (seed_match ? 1 : 0);
+    result.score = left.best_score + right.best_score + (seed_match ? 2 : -1);
+    result.identity = (100.0 * matches) / length;
+
     return result;
 }
 
+__attribute__((flatten))
+static ExtensionResult extendScalar(const PackedView& db_seq, const PackedView& query,
+                                    int db_seed_pos, int q_seed_pos) {
+    return extendKernel<ScalarBlock>(db_seq, query, db_seed_pos, q_seed_pos);
+}
+
+#ifdef SCORING_X86
+__attribute__((target("sse4.2"), flatten))
+static ExtensionResult extendSse42(const PackedView& db_seq, const PackedView& query,
+                                   int db_seed_pos, int q_seed_pos) {
+    return extendKernel<Sse42Block>(db_seq, query, db_seed_pos, q_seed_pos);
+}
+
+__attribute__((target("avx2"), flatten))
+static ExtensionResult extendAvx2(const PackedView& db_seq, const PackedView& query,
+                                  int db_seed_pos, int q_seed_pos) {
+    return extendKernel<Avx2Block>(db_seq, query, db_seed_pos, q_seed_pos);
+}
+#endif
+
+// Check whether this CPU can run a kernel
+bool extensionKernelSupported(ExtensionKernel kernel) {
+    switch (kernel) {
+        case ExtensionKernel::Auto:
+        case ExtensionKernel::Scalar:
+            return true;
+#ifdef SCORING_X86
+        case ExtensionKernel::Sse42:
+            return __builtin_cpu_supports("sse4.2");
+        case ExtensionKernel::Avx2:
+            return __builtin_cpu_supports("avx2");
+#else
+        default:
+            return false;
+#endif
+    }
+    return false;
+}
+
+const char* extensionKernelName(ExtensionKernel kernel) {
+    switch (kernel) {
+        case ExtensionKernel::Auto:   return "auto";
+        case ExtensionKernel::Scalar: return "scalar";
+        case ExtensionKernel::Sse42:  return "sse4.2";
+        case ExtensionKernel::Avx2:   return "avx2";
+    }
+    return "unknown";
+}
+
+// Widest kernel this CPU supports
+ExtensionKernel bestExtensionKernel() {
+    if (extensionKernelSupported(ExtensionKernel::Avx2)) return ExtensionKernel::Avx2;
+    if (extensionKernelSupported(ExtensionKernel::Sse42)) return ExtensionKernel::Sse42;
+    return ExtensionKernel::Scalar;
+}
+
+using ExtendFunction = ExtensionResult (*)(const PackedView&, const PackedView&, int, int);
+
+static ExtendFunction kernelFunction(ExtensionKernel kernel) {
+    if (kernel == ExtensionKernel::Auto) {
+        kernel = bestExtensionKernel();
+    }
+#ifdef SCORING_X86
+    if (kernel == ExtensionKernel::Avx2) return extendAvx2;
+    if (kernel == ExtensionKernel::Sse42) return extendSse42;
+#endif
+    return extendScalar;
+}
+
+// Perform ungapped extension from a seed position
+// Match: +2, Mismatch: -1 (ambiguous bases never match)
+// Extends both left and right from seed with the widest kernel the CPU
+// supports, chosen once on first use
+ExtensionResult extendUngapped(
+    const PackedView& db_seq,
+    const PackedView& query,
+    int db_seed_pos,
+    int q_seed_pos
+) {
+    static const ExtendFunction extend = kernelFunction(ExtensionKernel::Auto);
+    return extend(db_seq, query, db_seed_pos, q_seed_pos);
+}
+
+// Perform ungapped extension with a specific kernel (for benchmarks)
+ExtensionResult extendUngappedWith(
+    ExtensionKernel kernel,
+    const PackedView& db_seq,
+    const PackedView& query,
+    int db_seed_pos,
+    int q_seed_pos
+) {
+    return kernelFunction(kernel)(db_seq, query, db_seed_pos, q_seed_pos);
+}
+
+// Count matching bases in an ungapped alignment, one window at a time
+size_t countMatches(
+    const PackedView& db_seq,
+    const PackedView& query,
+    size_t db_start,
+    size_t q_start,
+    size_t len
+) {
+    size_t mismatches = 0;
+    for (size_t done = 0; done < len; done += BASES_PER_WORD) {
+        size_t n = std::min<size_t>(BASES_PER_WORD, len - done);
+        uint64_t mism = windowMismatches(db_seq, db_start + done,
+                                         query, q_start + done) & leadingBases(n);
+        mismatches += static_cast<size_t>(__builtin_popcountll(mism));
+    }
+    return len - mismatches;
+}
+
 // Calculate percent identity for an alignment
 double calculateIdentity(
-    const std::string& db_seq,
-    const std::string& query,
+    const PackedView& db_seq,
+    const PackedView& query,
     int db_start,
     int db_end,
     int q_start,
@@ -130,24 +381,9 @@ double calculateIdentity(
     if (db_end < db_start || q_end < q_start) {
         return 0.0;
     }
-    
-    int matches = 0;
-    int total = 0;
-    
-    int db_pos = db_start;
-    int q_pos = q_start;
-    
-    while (db_pos <= db_end && q_pos <= q_end) {
-        total++;
-        if (db_seq[db_pos] == query[q_pos]) {
-            matches++;
-        }
-        db_pos++;
-        q_pos++;
-    }
-    
-    if (total == 0) return 0.0;
-    
+
+    int total = std::min(db_end - db_start, q_end - q_start) + 1;
+    size_t matches = countMatches(db_seq, query, db_start, q_start, total);
+
     return (100.0 * matches) / total;
 }
-
@@ -1,7 +1,8 @@
 #ifndef SCORING_H
 #define SCORING_H
 
-#include <string>
+#include <cstddef>
+#include "packed.h"
 
 // Ungapped extension result
 struct ExtensionResult {
@@ -13,25 +14,63 @@ struct ExtensionResult {
     double identity;   // Percent identity (0-100)
 };
 
+// Ungapped extension kernels. All return identical results; the SIMD
+// kernels compare 64 (SSE4.2) or 128 (AVX2) packed bases per step.
+enum class ExtensionKernel {
+    Auto,     // Widest kernel the CPU supports
+    Scalar,   // One 32-base word per step
+    Sse42,
+    Avx2
+};
+
 // Perform ungapped extension from a seed position
-// Match: +2, Mismatch: -1
-// Extends both left and right from seed
+// Match: +2, Mismatch: -1 (ambiguous bases never match)
+// Extends both left and right from seed with X-drop stopping, and
+// returns score and identity from the same single pass. Uses the widest
+// kernel this CPU supports, chosen at runtime.
 ExtensionResult extendUngapped(
-    const std::string& db_seq,
-    const std::string& query,
+    const PackedView& db_seq,
+    const PackedView& query,
+    int db_seed_pos,
+    int q_seed_pos
+);
+
+// Perform ungapped extension with a specific kernel (for benchmarks)
+// The kernel must be supported, see extensionKernelSupported
+ExtensionResult extendUngappedWith(
+    ExtensionKernel kernel,
+    const PackedView& db_seq,
+    const PackedView& query,
     int db_seed_pos,
     int q_seed_pos
 );
 
+// Check whether this CPU can run a kernel
+bool extensionKernelSupported(ExtensionKernel kernel);
+
+// Widest kernel this CPU supports
+ExtensionKernel bestExtensionKernel();
+
+const char* extensionKernelName(ExtensionKernel kernel);
+
 // Calculate percent identity for an alignment
 double calculateIdentity(
-    const std::string& db_seq,
-    const std::string& query,
+    const PackedView& db_seq,
+    const PackedView& query,
     int db_start,
     int db_end,
     int q_start,
     int q_end
 );
 
-#endif // SCORING_H
+// Count matching bases in the ungapped alignment of len bases starting at
+// db_start and q_start
+size_t countMatches(
+    const PackedView& db_seq,
+    const PackedView& query,
+    size_t db_start,
+    size_t q_start,
+    size_t len
+);
 
+#endif // SCORING_H
@@ -1,52 +1,295 @@
 #include "search.h"
 #include "index.h"
+#include "stats.h"
+#include "parallel.h"
 #include <algorithm>
+#include <limits>
 #include <set>
 
+// Per-query state of every (sequence, diagonal) that has been seeded,
+// in an open-addressing table keyed by sequence and diagonal. The slots
+// belong to the thread and are reused by its next query.
+class DiagonalTable {
+public:
+    struct Entry {
+        uint64_t key;
+        int reach;       // Last database position covered by an extension
+        int last_hit;    // Database position of a pending two-hit seed
+    };
+    
+    explicit DiagonalTable(size_t expected)
+        : slots_(storage().slots), spare_(storage().spare) {
+        size_t size = 64;
+        while (size < 2 * expected) size <<= 1;
+        slots_.assign(size, Entry{EMPTY, -1, -1});
+    }
+    
+    // Entry for a diagonal, created on first use
+    Entry& at(int sid, int diagonal) {
+        uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(sid)) << 32) |
+                       static_cast<uint32_t>(diagonal);
+        size_t mask = slots_.size() - 1;
+        size_t slot = static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 20) & mask;
+        while (slots_[slot].key != key) {
+            if (slots_[slot].key == EMPTY) {
+                if (2 * (used_ + 1) > slots_.size()) {
+                    grow();
+                    return at(sid, diagonal);
+                }
+                used_++;
+                slots_[slot] = Entry{key, -1, -1};
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return slots_[slot];
+    }
+    
+    size_t used() const { return used_; }
+    
+    // Drop the entries keep(entry) rejects
+    template <typename Keep>
+    void retain(Keep keep) {
+        spare_.swap(slots_);
+        slots_.assign(spare_.size(), Entry{EMPTY, -1, -1});
+        used_ = 0;
+        for (const Entry& entry : spare_) {
+            if (entry.key == EMPTY || !keep(entry)) continue;
+            Entry& moved = at(static_cast<int>(entry.key >> 32),
+                              static_cast<int>(static_cast<uint32_t>(entry.key)));
+            moved = entry;
+        }
+    }
+    
+private:
+    // No real key is all ones: that would need sequence index -1
+    static const uint64_t EMPTY = ~static_cast<uint64_t>(0);
+    
+    struct Storage {
+        std::vector<Entry> slots;
+        std::vector<Entry> spare;  // The slots before the last grow()
+    };
+    
+    static Storage& storage() {
+        thread_local Storage thread_storage;
+        return thread_storage;
+    }
+    
+    void grow() {
+        spare_.swap(slots_);
+        slots_.assign(spare_.size() * 2, Entry{EMPTY, -1, -1});
+        used_ = 0;
+        for (const Entry& entry : spare_) {
+            if (entry.key == EMPTY) continue;
+            Entry& moved = at(static_cast<int>(entry.key >> 32),
+                              static_cast<int>(static_cast<uint32_t>(entry.key)));
+            moved = entry;
+        }
+    }
+    
+    std::vector<Entry>& slots_;
+    std::vector<Entry>& spare_;
+    size_t used_ = 0;
+};
+
+// The slot table is sized for top_n, so it is reused from query to query
+void TopHits::reset(int top_n) {
+    top_n_ = top_n;
+    size_t size = 2;
+    int bits = 1;
+    while (top_n > 0 && size < 2 * static_cast<size_t>(top_n)) {
+        size *= 2;
+        ++bits;
+    }
+    if (slots_.size() != size) {
+        slots_.assign(size, Slot{-1, 0});
+        hash_shift_ = 64 - bits;
+    } else {
+        for (const Entry& entry : heap_) slots_[entry.slot].sid = -1;
+    }
+    heap_.clear();
+}
+
+// A sequence already in the heap only has its score raised; a new one
+// takes the place of the lowest entry once the heap is full. A score that
+// does not beat a full heap's minimum changes nothing either way.
+void TopHits::add(int sid, int score) {
+    if (top_n_ <= 0) return;
+    if (heap_.size() == static_cast<size_t>(top_n_) && score <= heap_[0].score) return;
+    size_t slot = findSlot(sid);
+    if (slots_[slot].sid == sid) {
+        size_t i = slots_[slot].pos;
+        if (score > heap_[i].score) {
+            heap_[i].score = score;
+            siftDown(i);
+        }
+        return;
+    }
+    if (heap_.size() < static_cast<size_t>(top_n_)) {
+        slots_[slot] = Slot{sid, static_cast<uint32_t>(heap_.size())};
+        heap_.push_back(Entry{score, sid, static_cast<uint32_t>(slot)});
+        siftUp(heap_.size() - 1);
+    } else if (score > heap_[0].score) {
+        eraseSlot(heap_[0].slot);
+        slot = findSlot(sid);
+        slots_[slot] = Slot{sid, 0};
+        heap_[0] = Entry{score, sid, static_cast<uint32_t>(slot)};
+        siftDown(0);
+    }
+}
+
+int TopHits::threshold() const {
+    if (top_n_ <= 0 || heap_.size() < static_cast<size_t>(top_n_)) {
+        return std::numeric_limits<int>::min();
+    }
+    return heap_[0].score;
+}
+
+void TopHits::prune(std::vector<HSP>& hsps) const {
+    int min_score = threshold();
+    hsps.erase(std::remove_if(hsps.begin(), hsps.end(),
+                              [min_score](const HSP& hsp) { return hsp.score < min_score; }),
+               hsps.end());
+}
+
+// Slot holding sid, or the empty slot where it would go
+size_t TopHits::findSlot(int sid) const {
+    size_t mask = slots_.size() - 1;
+    size_t slot = homeSlot(sid);
+    while (slots_[slot].sid >= 0 && slots_[slot].sid != sid) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Empty slot i, moving later slots of its probe run back so that every
+// sequence stays reachable from its home slot
+void TopHits::eraseSlot(size_t i) {
+    size_t mask = slots_.size() - 1;
+    for (size_t j = (i + 1) & mask; slots_[j].sid >= 0; j = (j + 1) & mask) {
+        size_t home = homeSlot(slots_[j].sid);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots_[i] = slots_[j];
+            heap_[slots_[i].pos].slot = static_cast<uint32_t>(i);
+            i = j;
+        }
+    }
+    slots_[i].sid = -1;
+}
+
+void TopHits::swapEntries(size_t a, size_t b) {
+    std::swap(heap_[a], heap_[b]);
+    slots_[heap_[a].slot].pos = static_cast<uint32_t>(a);
+    slots_[heap_[b].slot].pos = static_cast<uint32_t>(b);
+}
+
+void TopHits::siftUp(size_t i) {
+    while (i > 0 && heap_[(i - 1) / 2].score > heap_[i].score) {
+        swapEntries((i - 1) / 2, i);
+        i = (i - 1) / 2;
+    }
+}
+
+void TopHits::siftDown(size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap_.size(); ++child) {
+            if (heap_[child].score < heap_[smallest].score) smallest = child;
+        }
+        if (smallest == i) return;
+        swapEntries(i, smallest);
+        i = smallest;
+    }
+}
+
 // Find all HSPs for a query sequence
+// Every (sequence, diagonal) remembers how far its last extension reached,
+// and seeds that fall inside that region are not extended again
 std::vector<HSP> findHSPs(
-    const std::string& query,
-    const std::vector<Sequence>& database,
+    const PackedView& query,
+    const DatabaseView& database,
     const KmerIndex& index,
-    int k
+    const SearchOptions& options
 ) {
     std::vector<HSP> hsps;
-    int q_len = static_cast<int>(query.length());
+    findHSPs(query, database, index, options, hsps);
+    return hsps;
+}
+
+// Find all HSPs for a query sequence into a caller-owned vector
+void findHSPs(
+    const PackedView& query,
+    const DatabaseView& database,
+    const KmerIndex& index,
+    const SearchOptions& options,
+    std::vector<HSP>& hsps,
+    const std::vector<MaskInterval>* query_mask,
+    TopHits* top
+) {
+    hsps.clear();
+    int span = index.shape().span();
+    int q_length = static_cast<int>(query.size());
+    DiagonalTable diagonals(query.size());
+    [[maybe_unused]] uint64_t kmers_looked_up = 0, postings_visited = 0, extensions = 0;
     
-    // For each k-mer in query
-    for (int q_pos = 0; q_pos <= q_len - k; ++q_pos) {
-        // Get k-mer at query position
-        uint32_t kmer_key = getKmerAt(query, q_pos, k);
+    // For each valid seed in query (ambiguous and masked bases are skipped),
+    // or each minimizer when the index holds only minimizers
+    withSeedEncoder(index.shape(), [&](const auto& encoder) {
+        STATS_TIMER(Stage::Search);
         
-        // Skip invalid k-mers
-        if (kmer_key == 0) {
-            bool valid = true;
-            for (int j = 0; j < k; ++j) {
-                char c = query[q_pos + j];
-                if (c != 'A' && c != 'C' && c != 'G' && c != 'T' &&
-                    c != 'a' && c != 'c' && c != 'g' && c != 't') {
-                    valid = false;
-                    break;
+        // Extend from each database hit of a query seed, given as a range
+        // of postings
+        auto extendHits = [&](int q_pos, const Posting* first, const Posting* last) {
+            for (const Posting* posting = first; posting != last; ++posting) {
+                Posting hit = *posting;
+                int db_seq_idx = postingSeq(hit);
+                int db_seed_pos = postingPos(hit);
+                
+                // Skip seeds already covered by an extension on this diagonal
+                DiagonalTable::Entry& diagonal = diagonals.at(db_seq_idx, db_seed_pos - q_pos);
+                if (db_seed_pos + span - 1 <= diagonal.reach) continue;
+                
+                // Skip seeds that cannot reach the top hits: an alignment
+                // scores at most 2 per query base, and an ungapped one only
+                // has the bases of its diagonal
+                if (top) {
+                    int db_length = static_cast<int>(database.seq(db_seq_idx).size());
+                    int diagonal_start = db_seed_pos - q_pos;
+                    int bases = options.gapped
+                        ? std::min(q_length, db_length)
+                        : std::min(q_length, db_length - diagonal_start) - std::max(0, -diagonal_start);
+                    if (2 * bases < top->threshold()) continue;
+                }
+                
+                // Two-hit seeding: remember a lone seed and wait for a second,
+                // non-overlapping one close enough on the same diagonal
+                if (options.two_hit_window > 0) {
+                    int distance = db_seed_pos - diagonal.last_hit;
+                    if (diagonal.last_hit < 0 || distance > options.two_hit_window) {
+                        diagonal.last_hit = db_seed_pos;
+                        continue;
+                    }
+                    if (distance < span) continue;
                 }
-            }
-            if (!valid) continue;
-        }
-        
-        // Lookup in hash table
-        auto it = index.find(kmer_key);
-        if (it != index.end()) {
-            // For each hit in database
-            for (const auto& hit : it->second) {
-                int db_seq_idx = hit.first;
-                int db_seed_pos = hit.second;
                 
                 // Perform ungapped extension
                 ExtensionResult ext = extendUngapped(
-                    database[db_seq_idx].seq,
+                    database.seq(db_seq_idx),
                     query,
                     db_seed_pos,
                     q_pos
                 );
+                diagonal.reach = ext.db_end;
+                diagonal.last_hit = -1;
+                ++extensions;
+                
+                // Drop HSPs below the top hits, unless gapped extension
+                // may still raise their score
+                if (top) {
+                    bool may_gap = options.gapped && ext.score >= options.gapped_options.trigger;
+                    if (ext.score < top->threshold() && !may_gap) continue;
+                    top->add(db_seq_idx, ext.score);
+                }
                 
                 // Create HSP
                 HSP hsp;
@@ -60,121 +303,422 @@ std::vector<HSP> findHSPs(
                 
                 hsps.push_back(hsp);
             }
+        };
+        
+        // For each seed, its postings, straight from the index or decoded
+        auto search = [&](auto& kmers) {
+            while (kmers.next()) {
+                ++kmers_looked_up;
+                if (!index.isCompressed()) {
+                    PostingList range = index.lookup(kmers.key());
+                    postings_visited += range.size();
+                    extendHits(kmers.pos(), range.begin(), range.end());
+                    continue;
+                }
+                
+                // Compressed postings are decoded a block at a time, and
+                // only for the seeds that occur
+                PostingDecoder decoder = index.decoder(kmers.key());
+                postings_visited += decoder.size();
+                Posting block[POSTING_BLOCK];
+                while (size_t n = decoder.next(block)) {
+                    extendHits(kmers.pos(), block, block + n);
+                }
+            }
+        };
+        
+        if (index.window() > 1) {
+            MinimizerIterator kmers(query, encoder, index.window(), query_mask);
+            search(kmers);
+        } else {
+            KmerIterator kmers(query, encoder, query_mask);
+            search(kmers);
         }
-    }
+    });
+    STATS_COUNT(Counter::KmersLookedUp, kmers_looked_up);
+    STATS_COUNT(Counter::PostingsVisited, postings_visited);
+    STATS_COUNT(Counter::Extensions, extensions);
     
-    return hsps;
+    if (options.gapped) {
+        STATS_TIMER(Stage::Gapped);
+        gapHSPs(query, database, options.gapped_options, hsps);
+        if (top) {
+            for (const HSP& hsp : hsps) top->add(hsp.sid, hsp.score);
+            top->prune(hsps);
+        }
+    }
+    STATS_COUNT(Counter::HspsFound, hsps.size());
 }
 
-// Merge overlapping HSPs for the same sequence
-// Keeps the best scoring HSP when overlaps occur
-std::vector<HSP> mergeHSPs(const std::vector<HSP>& hsps) {
-    if (hsps.empty()) return hsps;
+// Seed hit of findBatchHSPs, with where its seed was so the HSPs of each
+// strand can be put back in the order findHSPs finds them
+struct BatchHit {
+    uint32_t strand;
+    int seed_q;
+    int seed_db;
+    HSP hsp;
+};
+
+// Find the HSPs of a batch of query strands in one pass over the database
+// Seeds on one (strand, diagonal) are met in the same order as findHSPs
+// meets them on its (sequence, diagonal), so extension and two-hit seeding
+// make the same choices. Only seeds skipped for the top hits can differ, as
+// each worker's collectors see a share of the database, and anything they
+// lead to is pruned in the end.
+void findBatchHSPs(
+    const std::vector<Sequence>& strands,
+    const DatabaseView& database,
+    const SeedShape& shape,
+    const SearchOptions& options,
+    int top_n,
+    int threads,
+    std::vector<std::vector<HSP>>& hsps,
+    std::vector<TopHits>& tops
+) {
+    // Postings of the strand index are (strand, query position)
+    KmerIndex strand_index;
+    {
+        STATS_TIMER(Stage::BuildIndex);
+        strand_index = buildIndex(strands, shape, IndexLayout::Auto,
+                                  DEFAULT_DIRECT_INDEX_BUDGET, threads);
+    }
+    int span = shape.span();
     
-    // Group HSPs by sequence ID
-    std::vector<std::vector<HSP>> by_sequence;
-    std::vector<int> seq_ids;
+    // Each worker collects its own hits and top hits per strand
+    struct Worker {
+        std::vector<BatchHit> hits;
+        std::vector<TopHits> tops;
+    };
+    std::vector<Worker> workers(std::max(threads, 1));
+    parallelFor(static_cast<size_t>(database.size()), threads, [&](size_t s, int w) {
+        Worker& worker = workers[w];
+        if (worker.tops.empty()) worker.tops.assign(strands.size(), TopHits(top_n));
+        int sid = static_cast<int>(s);
+        PackedView db_seq = database.seq(sid);
+        int db_length = static_cast<int>(db_seq.size());
+        // The diagonals of every strand share one table. Once it fills,
+        // the entries no seed further on can use are dropped, so it stays
+        // about as small as findHSPs's table of one query.
+        DiagonalTable diagonals(4096);
+        size_t prune_at = 4096;
+        [[maybe_unused]] uint64_t kmers_looked_up = 0, postings_visited = 0, extensions = 0;
+        
+        withSeedEncoder(shape, [&](const auto& encoder) {
+            STATS_TIMER(Stage::Search);
+            KmerIterator kmers(db_seq, encoder, database.mask(sid));
+            while (kmers.next()) {
+                int db_seed_pos = kmers.pos();
+                if (diagonals.used() >= prune_at) {
+                    diagonals.retain([&](const DiagonalTable::Entry& entry) {
+                        return entry.reach >= db_seed_pos ||
+                               (entry.last_hit >= 0 &&
+                                db_seed_pos - entry.last_hit <= options.two_hit_window);
+                    });
+                    if (diagonals.used() >= prune_at / 2) prune_at *= 2;
+                }
+                PostingList range = strand_index.lookup(kmers.key());
+                ++kmers_looked_up;
+                postings_visited += range.size();
+                
+                for (Posting hit : range) {
+                    int strand = postingSeq(hit);
+                    int q_pos = postingPos(hit);
+                    DiagonalTable::Entry& diagonal = diagonals.at(strand, db_seed_pos - q_pos);
+                    if (db_seed_pos + span - 1 <= diagonal.reach) continue;
+                    
+                    // Skip seeds that cannot reach the top hits (see findHSPs)
+                    PackedView query = strands[strand].seq.view();
+                    int q_length = static_cast<int>(query.size());
+                    TopHits& top = worker.tops[strand];
+                    int diagonal_start = db_seed_pos - q_pos;
+                    int bases = options.gapped
+                        ? std::min(q_length, db_length)
+                        : std::min(q_length, db_length - diagonal_start) - std::max(0, -diagonal_start);
+                    if (2 * bases < top.threshold()) continue;
+                    
+                    if (options.two_hit_window > 0) {
+                        int distance = db_seed_pos - diagonal.last_hit;
+                        if (diagonal.last_hit < 0 || distance > options.two_hit_window) {
+                            diagonal.last_hit = db_seed_pos;
+                            continue;
+                        }
+                        if (distance < span) continue;
+                    }
+                    
+                    ExtensionResult ext = extendUngapped(db_seq, query, db_seed_pos, q_pos);
+                    diagonal.reach = ext.db_end;
+                    diagonal.last_hit = -1;
+                    ++extensions;
+                    
+                    bool may_gap = options.gapped && ext.score >= options.gapped_options.trigger;
+                    if (ext.score < top.threshold() && !may_gap) continue;
+                    top.add(sid, ext.score);
+                    
+                    BatchHit batch_hit;
+                    batch_hit.strand = static_cast<uint32_t>(strand);
+                    batch_hit.seed_q = q_pos;
+                    batch_hit.seed_db = db_seed_pos;
+                    HSP& hsp = batch_hit.hsp;
+                    hsp.sid = sid;
+                    hsp.db_start = ext.db_start;
+                    hsp.db_end = ext.db_end;
+                    hsp.q_start = ext.q_start;
+                    hsp.q_end = ext.q_end;
+                    hsp.score = ext.score;
+                    hsp.identity = ext.identity;
+                    worker.hits.push_back(std::move(batch_hit));
+                }
+            }
+        });
+        STATS_COUNT(Counter::KmersLookedUp, kmers_looked_up);
+        STATS_COUNT(Counter::PostingsVisited, postings_visited);
+        STATS_COUNT(Counter::Extensions, extensions);
+    });
     
-    for (const auto& hsp : hsps) {
-        auto it = std::find(seq_ids.begin(), seq_ids.end(), hsp.sid);
-        if (it == seq_ids.end()) {
-            seq_ids.push_back(hsp.sid);
-            by_sequence.push_back({hsp});
+    // Every strand's HSPs in the order findHSPs finds them: by the query
+    // position of the seed, then by database sequence and position
+    std::vector<BatchHit> all;
+    for (Worker& worker : workers) {
+        if (all.empty()) {
+            all.swap(worker.hits);
         } else {
-            int idx = std::distance(seq_ids.begin(), it);
-            by_sequence[idx].push_back(hsp);
+            all.insert(all.end(), std::make_move_iterator(worker.hits.begin()),
+                       std::make_move_iterator(worker.hits.end()));
         }
+        worker.hits = std::vector<BatchHit>();
     }
+    std::sort(all.begin(), all.end(), [](const BatchHit& a, const BatchHit& b) {
+        if (a.strand != b.strand) return a.strand < b.strand;
+        if (a.seed_q != b.seed_q) return a.seed_q < b.seed_q;
+        if (a.hsp.sid != b.hsp.sid) return a.hsp.sid < b.hsp.sid;
+        return a.seed_db < b.seed_db;
+    });
+    hsps.resize(strands.size());
+    for (auto& list : hsps) list.clear();
+    for (BatchHit& hit : all) hsps[hit.strand].push_back(std::move(hit.hsp));
+    all = std::vector<BatchHit>();
     
+    // Gapped re-alignment, then the top hits of each strand over the whole
+    // database
+    tops.assign(strands.size(), TopHits(top_n));
+    parallelFor(strands.size(), threads, [&](size_t i, int) {
+        if (options.gapped) {
+            STATS_TIMER(Stage::Gapped);
+            gapHSPs(strands[i].seq.view(), database, options.gapped_options, hsps[i]);
+        }
+        for (const HSP& hsp : hsps[i]) tops[i].add(hsp.sid, hsp.score);
+        tops[i].prune(hsps[i]);
+        STATS_COUNT(Counter::HspsFound, hsps[i].size());
+    });
+}
+
+// Re-align promising HSPs with gaps, best first
+void gapHSPs(
+    const PackedView& query,
+    const DatabaseView& database,
+    const GappedOptions& options,
+    std::vector<HSP>& hsps
+) {
+    // Buffers of the thread, reused by its next call
+    thread_local std::vector<HSP> ungapped;
+    thread_local std::vector<uint32_t> order;
+    thread_local std::vector<size_t> gapped_hsps;  // Indices of re-aligned HSPs in hsps
+    ungapped.assign(hsps.begin(), hsps.end());
+    hsps.clear();
+    gapped_hsps.clear();
+    
+    // Best first, ties in the order found
+    order.resize(ungapped.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<uint32_t>(i);
+    std::sort(order.begin(), order.end(), [](uint32_t a, uint32_t b) {
+        return ungapped[a].score > ungapped[b].score ||
+               (ungapped[a].score == ungapped[b].score && a < b);
+    });
+    
+    for (uint32_t i : order) {
+        HSP& hsp = ungapped[i];
+        if (hsp.score < options.trigger) {
+            hsps.push_back(hsp);
+            continue;
+        }
+        
+        // Skip HSPs that an earlier gapped alignment already covers
+        bool covered = false;
+        for (size_t g = 0; g < gapped_hsps.size() && !covered; ++g) {
+            const HSP& other = hsps[gapped_hsps[g]];
+            covered = other.sid == hsp.sid &&
+                      other.db_start <= hsp.db_start && hsp.db_end <= other.db_end &&
+                      other.q_start <= hsp.q_start && hsp.q_end <= other.q_end;
+        }
+        if (covered) continue;
+        
+        int middle = (hsp.db_end - hsp.db_start) / 2;
+        STATS_COUNT(Counter::GappedExtensions, 1);
+        GappedResult gapped = extendGapped(database.seq(hsp.sid), query,
+                                           hsp.db_start + middle, hsp.q_start + middle,
+                                           options);
+        if (gapped.score >= hsp.score) {
+            hsp.db_start = gapped.db_start;
+            hsp.db_end = gapped.db_end;
+            hsp.q_start = gapped.q_start;
+            hsp.q_end = gapped.q_end;
+            hsp.score = gapped.score;
+            hsp.identity = gapped.identity;
+            hsp.cigar = std::move(gapped.cigar);
+            gapped_hsps.push_back(hsps.size());
+        }
+        hsps.push_back(std::move(hsp));
+    }
+}
+
+// Mark HSPs found with a reverse-complemented query as minus-strand HSPs
+void toMinusStrand(std::vector<HSP>& hsps, int query_length) {
+    for (HSP& hsp : hsps) {
+        int q_start = query_length - 1 - hsp.q_end;
+        hsp.q_end = query_length - 1 - hsp.q_start;
+        hsp.q_start = q_start;
+        hsp.minus_strand = true;
+    }
+}
+
+// Merge overlapping HSPs for the same sequence and strand
+// Keeps the best scoring HSP when overlaps occur
+//
+// HSPs are bucketed by sequence, in order of first appearance, and each
+// bucket is swept in order of db_start, then input order. An HSP is compared with the first
+// kept HSP of its strand (in the order they were kept) whose range reaches
+// its start. As starts only grow during the sweep, a kept HSP that ends
+// before the current start can never overlap a later one, so each strand
+// keeps a cursor past such HSPs and the sweep is linear after the sort.
+std::vector<HSP> mergeHSPs(const std::vector<HSP>& hsps) {
     std::vector<HSP> merged;
+    mergeHSPs(hsps, merged);
+    return merged;
+}
+
+// Scratch buffers of mergeHSPs, kept by each thread between calls
+struct MergeWorkspace {
+    std::vector<uint32_t> bucket_of;     // Bucket of each sequence ID, or NO_BUCKET
+    std::vector<uint32_t> bucket;        // Bucket of each HSP
+    std::vector<uint32_t> bucket_start;
+    std::vector<uint32_t> order;         // HSP indices, bucket by bucket
+    std::vector<uint32_t> fill;
+    std::vector<size_t> kept[2];         // Indices into merged, per strand, in order kept
+};
+
+static const uint32_t NO_BUCKET = ~static_cast<uint32_t>(0);
+
+void mergeHSPs(const std::vector<HSP>& hsps, std::vector<HSP>& merged) {
+    merged.clear();
+    if (hsps.empty()) return;
+    thread_local MergeWorkspace ws;
+    
+    // Bucket HSP indices by sequence ID with a counting pass
+    std::vector<uint32_t>& bucket_of = ws.bucket_of;
+    std::vector<uint32_t>& bucket = ws.bucket;
+    std::vector<uint32_t>& bucket_start = ws.bucket_start;
+    bucket.resize(hsps.size());
+    bucket_start.clear();
+    for (size_t i = 0; i < hsps.size(); ++i) {
+        size_t sid = static_cast<size_t>(hsps[i].sid);
+        if (sid >= bucket_of.size()) bucket_of.resize(sid + 1, NO_BUCKET);
+        if (bucket_of[sid] == NO_BUCKET) {
+            bucket_of[sid] = static_cast<uint32_t>(bucket_start.size());
+            bucket_start.push_back(0);
+        }
+        bucket[i] = bucket_of[sid];
+        ++bucket_start[bucket[i]];
+    }
+    for (const HSP& hsp : hsps) bucket_of[hsp.sid] = NO_BUCKET;
+    uint32_t total = 0;
+    for (auto& start : bucket_start) {
+        uint32_t count = start;
+        start = total;
+        total += count;
+    }
+    bucket_start.push_back(total);
+    std::vector<uint32_t>& order = ws.order;
+    std::vector<uint32_t>& fill = ws.fill;
+    std::vector<size_t>* kept = ws.kept;
+    order.resize(hsps.size());
+    fill.assign(bucket_start.begin(), bucket_start.end() - 1);
+    for (size_t i = 0; i < hsps.size(); ++i) {
+        order[fill[bucket[i]]++] = static_cast<uint32_t>(i);
+    }
     
-    // For each sequence, merge overlapping HSPs
-    for (auto& seq_hsps : by_sequence) {
+    for (size_t b = 0; b + 1 < bucket_start.size(); ++b) {
         // Sort by database start position
-        std::sort(seq_hsps.begin(), seq_hsps.end(),
-            [](const HSP& a, const HSP& b) {
-                return a.db_start < b.db_start;
-            });
+        auto first = order.begin() + bucket_start[b];
+        auto last = order.begin() + bucket_start[b + 1];
+        std::sort(first, last, [&hsps](uint32_t x, uint32_t y) {
+            return hsps[x].db_start < hsps[y].db_start ||
+                   (hsps[x].db_start == hsps[y].db_start && x < y);
+        });
         
-        // Simple merging: keep non-overlapping or best scoring overlapping
-        for (size_t i = 0; i < seq_hsps.size(); ++i) {
-            bool overlap = false;
+        kept[0].clear();
+        kept[1].clear();
+        size_t cursor[2] = {0, 0};
+        for (auto it = first; it != last; ++it) {
+            const HSP& hsp = hsps[*it];
+            int strand = hsp.minus_strand ? 1 : 0;
             
-            // Check if this HSP overlaps with any already merged for this sequence
-            for (const auto& m : merged) {
-                if (m.sid == seq_hsps[i].sid) {
-                    // Check overlap: ranges overlap if not (end1 < start2 || end2 < start1)
-                    if (!(seq_hsps[i].db_end < m.db_start || m.db_end < seq_hsps[i].db_start)) {
-                        overlap = true;
-                        // If current HSP has better score, we'll replace (handled below)
-                        break;
-                    }
-                }
-            }
+            // Every kept HSP starts at or before this one, so it overlaps
+            // exactly when it reaches db_start
+            std::vector<size_t>& list = kept[strand];
+            size_t& c = cursor[strand];
+            while (c < list.size() && merged[list[c]].db_end < hsp.db_start) ++c;
             
-            if (!overlap) {
-                merged.push_back(seq_hsps[i]);
+            if (c == list.size()) {
+                list.push_back(merged.size());
+                merged.push_back(hsp);
             } else {
-                // Replace overlapping HSP if this one is better
-                for (auto& m : merged) {
-                    if (m.sid == seq_hsps[i].sid) {
-                        if (!(seq_hsps[i].db_end < m.db_start || m.db_end < seq_hsps[i].db_start)) {
-                            if (seq_hsps[i].score > m.score ||
-                                (seq_hsps[i].score == m.score && seq_hsps[i].identity > m.identity)) {
-                                m = seq_hsps[i];
-                            }
-                            break;
-                        }
-                    }
+                // Replace the overlapping HSP if this one is better
+                HSP& m = merged[list[c]];
+                if (hsp.score > m.score || (hsp.score == m.score && hsp.identity > m.identity)) {
+                    m = hsp;
                 }
             }
         }
     }
-    
-    return merged;
+}
+
+// Sort HSPs best first and keep the top_n
+void rankHSPs(std::vector<HSP>& hsps, int top_n) {
+    auto better = [](const HSP& a, const HSP& b) {
+        if (a.score != b.score) return a.score > b.score;
+        if (a.identity != b.identity) return a.identity > b.identity;
+        if (a.sid != b.sid) return a.sid < b.sid;
+        if (a.minus_strand != b.minus_strand) return b.minus_strand;
+        if (a.db_start != b.db_start) return a.db_start < b.db_start;
+        return a.q_start < b.q_start;
+    };
+    if (top_n > 0 && static_cast<size_t>(top_n) < hsps.size()) {
+        std::partial_sort(hsps.begin(), hsps.begin() + top_n, hsps.end(), better);
+        hsps.resize(top_n);
+    } else {
+        std::sort(hsps.begin(), hsps.end(), better);
+    }
 }
 
 // Get alignment string representation
 std::string getAlignment(
-    const std::string& db_seq,
-    const std::string& query,
+    const PackedView& db_seq,
+    const PackedView& query,
     int db_start,
     int db_end,
     int q_start,
-    int q_end
+    int q_end,
+    const std::string& cigar
 ) {
-    std::string alignment;
-    
-    if (db_end < db_start || q_end < q_start) {
-        return alignment;
+    std::string db_line, match_line, q_line;
+    forEachAlignmentColumn(db_seq, query, db_start, db_end, q_start, q_end, cigar,
+        [&](char db_base, char q_base) {
+            db_line += db_base;
+            match_line += isMatchColumn(db_base, q_base) ? '|' : ' ';
+            q_line += q_base;
+        });
+    if (db_line.empty()) {
+        return db_line;
     }
-    
-    int db_pos = db_start;
-    int q_pos = q_start;
-    
-    std::string db_line;
-    std::string match_line;
-    std::string q_line;
-    
-    while (db_pos <= db_end && q_pos <= q_end) {
-        char db_char = db_seq[db_pos];
-        char q_char = query[q_pos];
-        
-        db_line += db_char;
-        q_line += q_char;
-        
-        if (db_char == q_char) {
-            match_line += '|';
-        } else {
-            match_line += ' ';
-        }
-        
-        db_pos++;
-        q_pos++;
-    }
-    
-    alignment = db_line + "\n" + match_line + "\n" + q_line;
-    
-    return alignment;
+    return db_line + "\n" + match_line + "\n" + q_line;
 }
-
@@ -1,11 +1,14 @@
 #ifndef SEARCH_H
 #define SEARCH_H
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include "fasta.h"
+#include "database.h"
 #include "index.h"
 #include "scoring.h"
+#include "gapped.h"
 
 // High Scoring Pair (HSP) structure
 struct HSP {
@@ -16,28 +19,220 @@ struct HSP {
     int q_end;         // End position in query
     int score;         // Alignment score
     double identity;   // Percent identity
+    std::string cigar; // Gapped alignment (empty for an ungapped HSP)
+    bool minus_strand = false;  // Database aligned to the query's reverse complement
+};
+
+// Query strands to search
+enum class Strand {
+    Plus,    // The query as given
+    Minus,   // Its reverse complement
+    Both
+};
+
+// Tuning knobs for findHSPs
+struct SearchOptions {
+    // Two-hit seeding: extend only once a second, non-overlapping seed lands
+    // on the same diagonal within this many bases of the first (0 = off)
+    int two_hit_window = 0;
+    
+    // Gapped stage: re-align HSPs whose ungapped score reaches
+    // gapped_options.trigger with a banded affine-gap X-drop alignment
+    bool gapped = false;
+    GappedOptions gapped_options;
+};
+
+// Bounded collector for the best top_n hits of one query strand.
+// It keeps a min-heap of the best score seen on up to top_n distinct
+// database sequences. Each of them ends up as a reported hit that scores
+// at least as much, since merging and gapped extension never lower the
+// best score of a sequence. So once the heap is full, an HSP that scores
+// below its minimum cannot make the top_n, and findHSPs drops it at once.
+class TopHits {
+public:
+    explicit TopHits(int top_n = 0) { reset(top_n); }
+    
+    // Start over for a new query (top_n = 0 collects everything)
+    void reset(int top_n);
+    
+    // Record an HSP score on database sequence sid
+    void add(int sid, int score);
+    
+    // Lowest score a hit can have and still make the top_n
+    int threshold() const;
+    
+    // Remove HSPs that score below threshold()
+    void prune(std::vector<HSP>& hsps) const;
+    
+private:
+    struct Entry {
+        int score;
+        int sid;
+        uint32_t slot;   // Slot of sid in slots_
+    };
+    
+    // Where a sequence's entry is in the heap; sid < 0 marks an empty slot
+    struct Slot {
+        int sid;
+        uint32_t pos;
+    };
+    
+    size_t homeSlot(int sid) const {
+        return static_cast<size_t>((static_cast<uint64_t>(static_cast<uint32_t>(sid)) *
+                                    0x9E3779B97F4A7C15ull) >> hash_shift_);
+    }
+    size_t findSlot(int sid) const;
+    void eraseSlot(size_t i);
+    void swapEntries(size_t a, size_t b);
+    void siftUp(size_t i);
+    void siftDown(size_t i);
+    
+    int top_n_ = 0;
+    std::vector<Entry> heap_;  // Min-heap on score, one entry per sequence
+    std::vector<Slot> slots_;  // Linear-probing table from sid to heap position,
+                               // at most half full
+    int hash_shift_ = 63;
 };
 
 // Find all HSPs for a query sequence
+// Every (sequence, diagonal) remembers how far its last extension reached,
+// and seeds that fall inside that region are not extended again
+// With options.gapped the HSPs then go through gapHSPs
 std::vector<HSP> findHSPs(
-    const std::string& query,
-    const std::vector<Sequence>& database,
+    const PackedView& query,
+    const DatabaseView& database,
     const KmerIndex& index,
-    int k
+    const SearchOptions& options = SearchOptions()
+);
+
+// Same, but fills a caller-owned vector (cleared first) so its capacity
+// can be reused from one query to the next. Query seeds overlapping an
+// interval of query_mask (see dustMask) are skipped. With a collector,
+// HSPs below its threshold are dropped, and seeds whose diagonal (or, with
+// gapped extension, whose sequence) is too short to reach it are not
+// extended at all. With a minimizer index only the query's own minimizers
+// are looked up. Scratch buffers belong to the calling thread and are
+// reused by its next query.
+void findHSPs(
+    const PackedView& query,
+    const DatabaseView& database,
+    const KmerIndex& index,
+    const SearchOptions& options,
+    std::vector<HSP>& hsps,
+    const std::vector<MaskInterval>* query_mask = nullptr,
+    TopHits* top = nullptr
+);
+
+// Find the HSPs of many query strands at once, the other way round from
+// findHSPs: index the seeds of the strands (whose mask intervals start no
+// seeds), then stream every database sequence once, on `threads` workers,
+// and look its seeds up among them. hsps[i] and tops[i] (resized to one
+// per strand) get what findHSPs with a top_n collector gives strands[i],
+// in the same order, except that HSPs too weak for the top hits are
+// pruned. Database masks are honoured; a stop list is not, so the
+// database must be searchable without one.
+void findBatchHSPs(
+    const std::vector<Sequence>& strands,
+    const DatabaseView& database,
+    const SeedShape& shape,
+    const SearchOptions& options,
+    int top_n,
+    int threads,
+    std::vector<std::vector<HSP>>& hsps,
+    std::vector<TopHits>& tops
 );
 
-// Merge overlapping HSPs for the same sequence
+// Re-align the HSPs whose ungapped score reaches options.trigger with gaps,
+// best first, anchored at the middle of the ungapped alignment. An HSP
+// that lies inside a gapped alignment found before it is dropped; a gapped
+// alignment replaces its HSP only if it does not score lower.
+void gapHSPs(
+    const PackedView& query,
+    const DatabaseView& database,
+    const GappedOptions& options,
+    std::vector<HSP>& hsps
+);
+
+// Mark HSPs found with the reverse complement of a query of query_length
+// bases as minus-strand HSPs. q_start and q_end are turned into positions
+// on the query as given (q_start <= q_end still holds); the database range
+// and CIGAR string are unchanged, so they still pair the database with the
+// reverse complement.
+void toMinusStrand(std::vector<HSP>& hsps, int query_length);
+
+// Merge overlapping HSPs for the same sequence and strand
 // Keeps the best scoring HSP when overlaps occur
 std::vector<HSP> mergeHSPs(const std::vector<HSP>& hsps);
 
+// Same, into a caller-owned vector (cleared first). Its scratch buffers
+// belong to the calling thread, so once they have grown to fit, merging
+// does not allocate.
+void mergeHSPs(const std::vector<HSP>& hsps, std::vector<HSP>& merged);
+
+// Sort HSPs best first and keep the first top_n (0 = all)
+// Score and then identity rank HSPs; ties go to the lower sequence index,
+// plus strand and database position, so the order does not depend on the
+// order the HSPs were found in.
+void rankHSPs(std::vector<HSP>& hsps, int top_n);
+
+// Whether an alignment column pairs two equal bases; ambiguous bases and
+// gaps never match
+inline bool isMatchColumn(char db_base, char q_base) {
+    return db_base == q_base &&
+           (db_base == 'A' || db_base == 'C' || db_base == 'G' || db_base == 'T');
+}
+
+// Visit the columns of an alignment in order as fn(db_base, q_base), with
+// '-' on the gapped side. With a CIGAR string the alignment starts at
+// db_start / q_start; without one it is ungapped over the shorter range.
+template<typename Fn>
+void forEachAlignmentColumn(
+    const PackedView& db_seq,
+    const PackedView& query,
+    int db_start,
+    int db_end,
+    int q_start,
+    int q_end,
+    const std::string& cigar,
+    Fn fn
+) {
+    if (db_end < db_start || q_end < q_start) return;
+    
+    if (cigar.empty()) {
+        size_t len = static_cast<size_t>(std::min(db_end - db_start, q_end - q_start) + 1);
+        std::string db_bases = db_seq.substr(db_start, len);
+        std::string q_bases = query.substr(q_start, len);
+        for (size_t i = 0; i < len; ++i) fn(db_bases[i], q_bases[i]);
+        return;
+    }
+    
+    size_t db_pos = db_start, q_pos = q_start;
+    size_t count = 0;
+    for (char c : cigar) {
+        if (c >= '0' && c <= '9') {
+            count = count * 10 + static_cast<size_t>(c - '0');
+            continue;
+        }
+        for (size_t n = 0; n < count; ++n) {
+            char db_base = c == 'I' ? '-' : db_seq.at(db_pos++);
+            char q_base = c == 'D' ? '-' : query.at(q_pos++);
+            fn(db_base, q_base);
+        }
+        count = 0;
+    }
+}
+
 // Get alignment string representation
+// With a CIGAR string the gaps are shown as '-'; without one the
+// alignment is ungapped
 std::string getAlignment(
-    const std::string& db_seq,
-    const std::string& query,
+    const PackedView& db_seq,
+    const PackedView& query,
     int db_start,
     int db_end,
     int q_start,
-    int q_end
+    int q_end,
+    const std::string& cigar = std::string()
 );
 
 #endif // SEARCH_H
@@ -0,0 +1,79 @@
+#include "seed.h"
+#include <iostream>
+#include <utility>
+
+SeedShape SeedShape::contiguous(int k) {
+    return fromMask((static_cast<uint64_t>(1) << k) - 1, k);
+}
+
+// Runs are found from the last base backwards, so the shift of each run is
+// the room taken by the bases after it minus that of the '1's after it
+SeedShape SeedShape::fromMask(uint64_t mask, int span) {
+    SeedShape shape;
+    shape.mask_ = mask;
+    shape.span_ = span;
+    int ones_after = 0;
+    for (int end = span - 1; end >= 0; ) {
+        if (!((mask >> end) & 1)) {
+            --end;
+            continue;
+        }
+        int start = end;
+        while (start > 0 && ((mask >> (start - 1)) & 1)) {
+            --start;
+        }
+        int length = end - start + 1;
+        unsigned low = 2 * static_cast<unsigned>(span - 1 - end);
+        uint64_t bits = length >= 32 ? ~static_cast<uint64_t>(0)
+                                     : ((static_cast<uint64_t>(1) << (2 * length)) - 1) << low;
+        shape.runs_[shape.num_runs_++] = Run{bits, low - 2 * static_cast<unsigned>(ones_after)};
+        ones_after += length;
+        end = start - 1;
+    }
+    shape.weight_ = ones_after;
+    
+    // Runs were collected last first; the key is assembled first run first
+    for (int r = 0; r < shape.num_runs_ / 2; ++r) {
+        std::swap(shape.runs_[r], shape.runs_[shape.num_runs_ - 1 - r]);
+    }
+    return shape;
+}
+
+bool SeedShape::isValid(uint64_t mask, int span) {
+    return span >= 1 && span <= MAX_SEED_SPAN &&
+           (mask >> span) == 0 &&
+           (mask & 1) && ((mask >> (span - 1)) & 1);
+}
+
+bool SeedShape::parse(const std::string& pattern, SeedShape* shape) {
+    if (pattern.empty() || static_cast<int>(pattern.size()) > MAX_SEED_SPAN) {
+        std::cerr << "Error: seed pattern must span 1 to " << MAX_SEED_SPAN
+                  << " bases" << std::endl;
+        return false;
+    }
+    uint64_t mask = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '0' && pattern[i] != '1') {
+            std::cerr << "Error: seed pattern may only contain 0 and 1" << std::endl;
+            return false;
+        }
+        if (pattern[i] == '1') {
+            mask |= static_cast<uint64_t>(1) << i;
+        }
+    }
+    int span = static_cast<int>(pattern.size());
+    if (!isValid(mask, span)) {
+        std::cerr << "Error: seed pattern must start and end with 1" << std::endl;
+        return false;
+    }
+    *shape = fromMask(mask, span);
+    return true;
+}
+
+std::string SeedShape::pattern() const {
+    std::string out(static_cast<size_t>(span_), '0');
+    for (int i = 0; i < span_; ++i) {
+        if ((mask_ >> i) & 1) out[i] = '1';
+    }
+    return out;
+}
@@ -0,0 +1,123 @@
+#ifndef SEED_H
+#define SEED_H
+
+#include <cstdint>
+#include <string>
+
+// Encoded k-mer or spaced-seed key: 2 bits per base, first base most
+// significant, so keys of up to 32 bases fit
+using KmerKey = uint64_t;
+
+// Longest seed span; a seed's bases are read from one 32-base window
+const int MAX_SEED_SPAN = 32;
+
+// Seed shape: a pattern of '1' (base must match) and '0' (any base) over
+// span consecutive bases, such as "111010010100110111". The key of a seed
+// is the 2-bit codes of its '1' positions in order, so the contiguous
+// shape of k ones gives exactly the keys of encodeKmer. The weight, the
+// number of '1's, plays the role of k for the index.
+class SeedShape {
+public:
+    // One maximal run of '1's: its bases in a span window, and how far to
+    // shift them right to their place in the key
+    struct Run {
+        uint64_t bits;
+        unsigned shift;
+    };
+
+    SeedShape() = default;
+
+    // k consecutive bases
+    static SeedShape contiguous(int k);
+
+    // Shape with bit i of mask set for each '1' at position i
+    // The mask must satisfy isValid
+    static SeedShape fromMask(uint64_t mask, int span);
+
+    // Parse a pattern of '0' and '1' that starts and ends with '1'
+    // Returns false (after reporting the reason) if it is not valid
+    static bool parse(const std::string& pattern, SeedShape* shape);
+
+    // Whether mask and span describe a shape: span 1..MAX_SEED_SPAN, no
+    // bits past the span, and '1' at both ends
+    static bool isValid(uint64_t mask, int span);
+
+    int span() const { return span_; }
+    int weight() const { return weight_; }
+    uint64_t mask() const { return mask_; }
+    bool isContiguous() const { return num_runs_ == 1; }
+    std::string pattern() const;
+
+    int numRuns() const { return num_runs_; }
+    const Run& run(int r) const { return runs_[r]; }
+
+    bool operator==(const SeedShape& other) const {
+        return mask_ == other.mask_ && span_ == other.span_;
+    }
+    bool operator!=(const SeedShape& other) const { return !(*this == other); }
+
+private:
+    uint64_t mask_ = 0;
+    int span_ = 0;
+    int weight_ = 0;
+    int num_runs_ = 0;
+    Run runs_[(MAX_SEED_SPAN + 1) / 2] = {};
+};
+
+// Gathers the key of a seed out of a window holding its span bases, first
+// base in the most significant bits. Runs is the shape's number of runs of
+// '1's, so the loop unrolls into one mask and shift per run; the
+// contiguous shape (one run) is a single mask. Runs = 0 takes the count at
+// run time, for shapes without a specialization.
+template <int Runs>
+class SeedEncoder {
+public:
+    explicit SeedEncoder(const SeedShape& shape)
+        : span_(shape.span()), num_runs_(shape.numRuns()),
+          span_mask_(shape.span() >= 32 ? ~static_cast<uint64_t>(0)
+                                        : (static_cast<uint64_t>(1) << (2 * shape.span())) - 1) {
+        for (int r = 0; r < num_runs_; ++r) {
+            runs_[r] = shape.run(r);
+        }
+    }
+
+    int span() const { return span_; }
+
+    // Bits of a window that hold span bases
+    uint64_t spanMask() const { return span_mask_; }
+
+    KmerKey operator()(uint64_t window) const {
+        KmerKey key = 0;
+        for (int r = 0; r < (Runs > 0 ? Runs : num_runs_); ++r) {
+            key |= (window & runs_[r].bits) >> runs_[r].shift;
+        }
+        return key;
+    }
+
+private:
+    int span_;
+    int num_runs_;
+    uint64_t span_mask_;
+    SeedShape::Run runs_[Runs > 0 ? Runs : (MAX_SEED_SPAN + 1) / 2] = {};
+};
+
+// Call fn(encoder) with the encoder specialized for the shape: contiguous
+// seeds and spaced seeds of up to 8 runs (which covers the usual
+// PatternHunter and discontiguous MegaBLAST templates) get an unrolled
+// gather, anything else the generic loop
+template <typename Fn>
+void withSeedEncoder(const SeedShape& shape, Fn&& fn) {
+    switch (shape.numRuns()) {
+        case 1: fn(SeedEncoder<1>(shape)); break;
+        case 2: fn(SeedEncoder<2>(shape)); break;
+        case 3: fn(SeedEncoder<3>(shape)); break;
+        case 4: fn(SeedEncoder<4>(shape)); break;
+        case 5: fn(SeedEncoder<5>(shape)); break;
+        case 6: fn(SeedEncoder<6>(shape)); break;
+        case 7: fn(SeedEncoder<7>(shape)); break;
+        case 8: fn(SeedEncoder<8>(shape)); break;
+        default: fn(SeedEncoder<0>(shape)); break;
+    }
+}
+
+#endif // SEED_H
@@ -0,0 +1,346 @@
+#include "server.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Written to by the SIGINT/SIGTERM handler to wake the accept loop
+int stop_pipe[2] = {-1, -1};
+
+// A client that stalls halfway through a message, or does not read its
+// response, for this long is disconnected
+const int MESSAGE_TIMEOUT_SECONDS = 30;
+
+void onStopSignal(int) {
+    char c = 0;
+    ssize_t ignored = ::write(stop_pipe[1], &c, 1);
+    (void)ignored;
+}
+
+// Read exactly size bytes; false at end of input or on an error
+bool readFully(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::read(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Write all of data to a socket; a closed peer is an error, not SIGPIPE
+bool writeFully(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Read one message. Returns false at the end of the connection; *error
+// is then set unless the peer closed cleanly between messages.
+bool readMessage(int fd, std::string& message, std::string* error) {
+    unsigned char header[4];
+    ssize_t n;
+    do {
+        n = ::read(fd, header, 1);
+    } while (n < 0 && errno == EINTR);
+    if (n == 0) return false;
+    if (n < 0 || !readFully(fd, reinterpret_cast<char*>(header) + 1, 3)) {
+        *error = "connection lost";
+        return false;
+    }
+    uint32_t length = (static_cast<uint32_t>(header[0]) << 24) |
+                      (static_cast<uint32_t>(header[1]) << 16) |
+                      (static_cast<uint32_t>(header[2]) << 8) | header[3];
+    if (length > MAX_MESSAGE_BYTES) {
+        *error = "message of " + std::to_string(length) + " bytes is too large";
+        return false;
+    }
+    message.resize(length);
+    if (!readFully(fd, &message[0], length)) {
+        *error = "connection lost";
+        return false;
+    }
+    return true;
+}
+
+// Write one message made of prefix followed by body; false, with nothing
+// sent, if it would be larger than the peer accepts
+bool writeMessage(int fd, std::string_view prefix, std::string_view body) {
+    if (prefix.size() + body.size() > MAX_MESSAGE_BYTES) return false;
+    uint32_t length = static_cast<uint32_t>(prefix.size() + body.size());
+    unsigned char header[4] = {
+        static_cast<unsigned char>(length >> 24), static_cast<unsigned char>(length >> 16),
+        static_cast<unsigned char>(length >> 8), static_cast<unsigned char>(length)
+    };
+    return writeFully(fd, reinterpret_cast<const char*>(header), sizeof(header)) &&
+           writeFully(fd, prefix.data(), prefix.size()) &&
+           writeFully(fd, body.data(), body.size());
+}
+
+bool socketAddress(const std::string& path, sockaddr_un* address) {
+    std::memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address->sun_path)) {
+        std::cerr << "Error: Socket path must be 1 to " << sizeof(address->sun_path) - 1
+                  << " characters: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(address->sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// Connected socket to path, or -1
+int connectTo(const sockaddr_un& address) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void setTimeouts(int fd) {
+    timeval timeout = {MESSAGE_TIMEOUT_SECONDS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// Answer the next request of a connection that has input waiting.
+// Returns false once the connection is done with: closed by the client,
+// broken, or unable to take the response.
+bool serveRequest(int fd, int worker, const RequestHandler& handler) {
+    std::string request, response, error;
+    if (!readMessage(fd, request, &error)) {
+        if (!error.empty()) {
+            writeMessage(fd, "1", error);
+        }
+        return false;
+    }
+    bool ok = handler(request, worker, response);
+    if (response.size() >= MAX_MESSAGE_BYTES) {
+        return writeMessage(fd, "1", "report of " + std::to_string(response.size()) +
+                                     " bytes is too large (the limit is " +
+                                     std::to_string(MAX_MESSAGE_BYTES - 1) + ")");
+    }
+    return writeMessage(fd, ok ? "0" : "1", response);
+}
+
+} // namespace
+
+bool runServer(const std::string& socket_path, int threads, const RequestHandler& handler) {
+    sockaddr_un address;
+    if (!socketAddress(socket_path, &address)) {
+        return false;
+    }
+
+    // Replace the socket file of a server that is gone, but never a live
+    // server's or a file that is not a socket
+    struct stat info;
+    if (::lstat(socket_path.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            std::cerr << "Error: " << socket_path << " exists and is not a socket" << std::endl;
+            return false;
+        }
+        int probe = connectTo(address);
+        if (probe >= 0) {
+            ::close(probe);
+            std::cerr << "Error: A server is already listening on " << socket_path << std::endl;
+            return false;
+        }
+        ::unlink(socket_path.c_str());
+    }
+
+    int listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 ||
+        ::bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(listen_fd, 64) != 0) {
+        std::cerr << "Error: Cannot listen on " << socket_path << ": " << std::strerror(errno)
+                  << std::endl;
+        if (listen_fd >= 0) ::close(listen_fd);
+        return false;
+    }
+    if (::pipe(stop_pipe) != 0) {
+        std::cerr << "Error: Cannot create pipe: " << std::strerror(errno) << std::endl;
+        ::close(listen_fd);
+        ::unlink(socket_path.c_str());
+        return false;
+    }
+    struct sigaction stop_action, old_int, old_term;
+    std::memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = onStopSignal;
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, &old_int);
+    sigaction(SIGTERM, &stop_action, &old_term);
+
+    // Workers hand a connection back through wake_pipe once its request
+    // is answered, so the accept loop polls it again
+    int wake_pipe[2];
+    if (::pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        std::cerr << "Error: Cannot create pipe: " << std::strerror(errno) << std::endl;
+        ::close(listen_fd);
+        ::unlink(socket_path.c_str());
+        ::close(stop_pipe[0]);
+        ::close(stop_pipe[1]);
+        stop_pipe[0] = stop_pipe[1] = -1;
+        sigaction(SIGINT, &old_int, nullptr);
+        sigaction(SIGTERM, &old_term, nullptr);
+        return false;
+    }
+
+    // A connection is idle (polled by the accept loop), pending (has a
+    // request waiting for a free worker) or active (being answered), so an
+    // idle client never holds a worker
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<int> idle;
+    std::deque<int> pending;
+    std::set<int> active;
+    bool stopping = false;
+    std::vector<std::thread> pool;
+    for (int worker = 0; worker < std::max(1, threads); ++worker) {
+        pool.emplace_back([&, worker] {
+            for (;;) {
+                int fd;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [&] { return stopping || !pending.empty(); });
+                    if (stopping) return;
+                    fd = pending.front();
+                    pending.pop_front();
+                    active.insert(fd);
+                }
+                bool keep = serveRequest(fd, worker, handler);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    active.erase(fd);
+                    if (keep && !stopping) {
+                        idle.push_back(fd);
+                        char c = 0;
+                        ssize_t ignored = ::write(wake_pipe[1], &c, 1);
+                        (void)ignored;
+                        continue;
+                    }
+                }
+                ::close(fd);
+            }
+        });
+    }
+
+    std::cerr << "Listening on " << socket_path << " with " << pool.size()
+              << (pool.size() == 1 ? " worker" : " workers") << std::endl;
+    std::vector<pollfd> fds;
+    for (;;) {
+        fds.assign({{listen_fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}, {wake_pipe[0], POLLIN, 0}});
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int fd : idle) fds.push_back({fd, POLLIN, 0});
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: poll failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        if (fds[1].revents != 0) break;
+        if (fds[2].revents != 0) {
+            char drain[64];
+            ssize_t ignored = ::read(wake_pipe[0], drain, sizeof(drain));
+            (void)ignored;
+        }
+
+        // Idle connections with input (a request, or the client closing)
+        // move to the queue; new connections start out idle
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 3; i < fds.size(); ++i) {
+            if (fds[i].revents == 0) continue;
+            idle.erase(std::find(idle.begin(), idle.end(), fds[i].fd));
+            pending.push_back(fds[i].fd);
+            ready.notify_one();
+        }
+        if (fds[0].revents != 0) {
+            int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                setTimeouts(fd);
+                idle.push_back(fd);
+            }
+        }
+    }
+
+    // Stop: drop idle and queued connections and cut off the ones being
+    // served
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for (int fd : idle) ::close(fd);
+        idle.clear();
+        for (int fd : pending) ::close(fd);
+        pending.clear();
+        for (int fd : active) ::shutdown(fd, SHUT_RDWR);
+    }
+    ready.notify_all();
+    for (auto& thread : pool) thread.join();
+
+    ::close(listen_fd);
+    ::unlink(socket_path.c_str());
+    sigaction(SIGINT, &old_int, nullptr);
+    sigaction(SIGTERM, &old_term, nullptr);
+    ::close(stop_pipe[0]);
+    ::close(stop_pipe[1]);
+    stop_pipe[0] = stop_pipe[1] = -1;
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+    std::cerr << "Server on " << socket_path << " stopped" << std::endl;
+    return true;
+}
+
+bool sendRequest(const std::string& socket_path, std::string_view request,
+                 std::string& response, bool* ok) {
+    sockaddr_un address;
+    if (!socketAddress(socket_path, &address)) {
+        return false;
+    }
+    if (request.size() > MAX_MESSAGE_BYTES) {
+        std::cerr << "Error: Request of " << request.size() << " bytes is too large" << std::endl;
+        return false;
+    }
+    int fd = connectTo(address);
+    if (fd < 0) {
+        std::cerr << "Error: Cannot connect to " << socket_path << ": " << std::strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    std::string error;
+    bool received = writeMessage(fd, std::string_view(), request) &&
+                    readMessage(fd, response, &error) && !response.empty();
+    ::close(fd);
+    if (!received) {
+        std::cerr << "Error: No response from " << socket_path
+                  << (error.empty() ? "" : ": " + error) << std::endl;
+        return false;
+    }
+    *ok = response[0] == '0';
+    response.erase(0, 1);
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Resident search server over a Unix domain socket.
+//
+// Protocol: every message is a 4-byte big-endian length followed by that
+// many bytes. A client sends any number of request messages on one
+// connection and receives one response message per request, in order.
+// The first byte of a response is a status: '0' when the rest is the
+// report, '1' when it is an error message.
+
+// Largest message either side accepts; a report that would not fit is
+// answered with an error response instead
+const uint32_t MAX_MESSAGE_BYTES = 1u << 30;
+
+// Answers one request on worker thread `worker` (in [0, threads)).
+// Returns false, with an error message in response, to reject it.
+using RequestHandler =
+    std::function<bool(std::string_view request, int worker, std::string& response)>;
+
+// Listen on socket_path and answer requests with handler on a pool of
+// `threads` workers until SIGINT or SIGTERM. A connection only takes a
+// worker while one of its requests is answered, so idle clients cannot
+// hold up the others; a client that stalls mid-message or does not read
+// its response for 30 s is disconnected. A stale socket file left by a server that is gone is replaced;
+// the socket file is removed on exit. Returns false if the socket cannot
+// be set up.
+bool runServer(const std::string& socket_path, int threads, const RequestHandler& handler);
+
+// Send one request to the server at socket_path and wait for its
+// response. Returns false on connection or protocol errors (reported on
+// std::cerr); otherwise *ok tells whether the server accepted the request.
+bool sendRequest(const std::string& socket_path, std::string_view request,
+                 std::string& response, bool* ok);
+
+#endif // SERVER_H
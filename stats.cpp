@@ -0,0 +1,160 @@
+#include "stats.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/resource.h>
+#include <time.h>
+
+RunStats& RunStats::operator+=(const RunStats& other) {
+    for (size_t i = 0; i < NUM_COUNTERS; ++i) counters[i] += other.counters[i];
+    for (size_t i = 0; i < NUM_STAGES; ++i) {
+        wall_seconds[i] += other.wall_seconds[i];
+        cpu_seconds[i] += other.cpu_seconds[i];
+    }
+    return *this;
+}
+
+RunStats& RunStats::operator-=(const RunStats& other) {
+    for (size_t i = 0; i < NUM_COUNTERS; ++i) counters[i] -= other.counters[i];
+    for (size_t i = 0; i < NUM_STAGES; ++i) {
+        wall_seconds[i] -= other.wall_seconds[i];
+        cpu_seconds[i] -= other.cpu_seconds[i];
+    }
+    return *this;
+}
+
+#ifndef BLASTN_NO_STATS
+
+bool stats_enabled = false;
+
+namespace {
+
+// One cache-line-aligned block per thread that ever counted; blocks
+// outlive their threads so that nothing is lost when a pool exits
+struct alignas(64) ThreadBlock {
+    RunStats stats;
+};
+
+std::mutex blocks_mutex;
+std::vector<std::unique_ptr<ThreadBlock>> blocks;
+
+const char* const STAGE_NAMES[NUM_STAGES] = {
+    "parse_database", "load_index", "dust", "build_index", "read_queries",
+    "search", "gapped", "merge", "output"
+};
+
+const char* const COUNTER_NAMES[NUM_COUNTERS] = {
+    "queries", "kmers_looked_up", "postings_visited", "extensions",
+    "gapped_extensions", "hsps_found", "hsps_merged", "hsps_reported"
+};
+
+double wallSeconds() {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double threadCpuSeconds() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) * 1e-9;
+}
+
+double seconds(const timeval& time) {
+    return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_usec) * 1e-6;
+}
+
+// Counters and stages from first on
+void printCounters(std::ostream& out, const RunStats& stats, size_t first) {
+    for (size_t i = first; i < NUM_COUNTERS; ++i) {
+        out << (i == first ? "" : ", ") << '"' << COUNTER_NAMES[i] << "\": " << stats.counters[i];
+    }
+}
+
+void printStages(std::ostream& out, const RunStats& stats, size_t first, const char* separator) {
+    for (size_t i = first; i < NUM_STAGES; ++i) {
+        out << (i == first ? "" : separator) << '"' << STAGE_NAMES[i] << "\": {\"wall\": "
+            << stats.wall_seconds[i] << ", \"cpu\": " << stats.cpu_seconds[i] << '}';
+    }
+}
+
+} // namespace
+
+void enableStats() {
+    stats_enabled = true;
+}
+
+RunStats& threadStats() {
+    thread_local RunStats* local = nullptr;
+    if (!local) {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        blocks.push_back(std::make_unique<ThreadBlock>());
+        local = &blocks.back()->stats;
+    }
+    return *local;
+}
+
+RunStats totalStats() {
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    RunStats total;
+    for (const auto& block : blocks) total += block->stats;
+    return total;
+}
+
+StageTimer::StageTimer(Stage stage) : stage_(stage), running_(statsEnabled()) {
+    if (running_) {
+        wall_start_ = wallSeconds();
+        cpu_start_ = threadCpuSeconds();
+    }
+}
+
+StageTimer::~StageTimer() {
+    if (running_) {
+        RunStats& stats = threadStats();
+        stats.wall_seconds[static_cast<size_t>(stage_)] += wallSeconds() - wall_start_;
+        stats.cpu_seconds[static_cast<size_t>(stage_)] += threadCpuSeconds() - cpu_start_;
+    }
+}
+
+void printStatsJson(std::ostream& out, const RunStats& stats, double elapsed_seconds,
+                    size_t index_bytes, int threads) {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    auto flags = out.flags();
+    out << std::fixed;
+    out.precision(6);
+    out << "{\n"
+        << "  \"elapsed_seconds\": " << elapsed_seconds << ",\n"
+        << "  \"cpu_seconds\": {\"user\": " << seconds(usage.ru_utime)
+        << ", \"system\": " << seconds(usage.ru_stime) << "},\n"
+        << "  \"peak_rss_bytes\": " << static_cast<uint64_t>(usage.ru_maxrss) * 1024 << ",\n"
+        << "  \"index_bytes\": " << index_bytes << ",\n"
+        << "  \"threads\": " << threads << ",\n"
+        << "  \"counters\": {";
+    printCounters(out, stats, 0);
+    out << "},\n"
+        << "  \"stages\": {\n    ";
+    printStages(out, stats, 0, ",\n    ");
+    out << "\n  }\n"
+        << "}" << std::endl;
+    out.flags(flags);
+}
+
+void printQueryStatsJson(std::ostream& out, std::string_view query, const RunStats& stats) {
+    auto flags = out.flags();
+    out << std::fixed;
+    out.precision(6);
+    out << "{\"query\": \"";
+    for (char c : query) {
+        if (c == '"' || c == '\\') out << '\\';
+        out << c;
+    }
+    out << "\", ";
+    printCounters(out, stats, static_cast<size_t>(Counter::KmersLookedUp));
+    out << ", ";
+    printStages(out, stats, static_cast<size_t>(Stage::Search), ", ");
+    out << "}\n";
+    out.flags(flags);
+}
+
+#endif // BLASTN_NO_STATS
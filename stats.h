@@ -0,0 +1,116 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+// Run statistics for --stats: wall and CPU time per stage, and counters
+// from the hot paths. Every thread counts into its own block, so workers
+// never contend; blocks are only summed when a report is written. Nothing
+// is recorded until enableStats() is called.
+//
+// Building with BLASTN_NO_STATS defined (make STATS=0) compiles all of it
+// out: STATS_COUNT and STATS_TIMER expand to nothing, and the functions
+// below are not declared.
+
+// Stages of a run. Wall and CPU time are summed over the threads that ran
+// a stage, so with several workers they can exceed the elapsed time.
+enum class Stage {
+    ParseDatabase,   // Database FASTA into packed sequences
+    LoadIndex,       // Mapping and checking an index file
+    Dust,            // Masking the database
+    BuildIndex,
+    ReadQueries,     // Reading and parsing query batches
+    Search,          // Seed lookup and ungapped extension (findHSPs)
+    Gapped,          // Gapped re-alignment (gapHSPs)
+    Merge,           // Merging and ranking HSPs
+    Output,          // Formatting and writing reports
+    Count
+};
+
+enum class Counter {
+    Queries,
+    KmersLookedUp,
+    PostingsVisited,
+    Extensions,        // Ungapped extensions
+    GappedExtensions,
+    HspsFound,         // HSPs returned by findHSPs
+    HspsMerged,        // HSPs left after merging
+    HspsReported,
+    Count
+};
+
+const size_t NUM_STAGES = static_cast<size_t>(Stage::Count);
+const size_t NUM_COUNTERS = static_cast<size_t>(Counter::Count);
+
+// Counters and stage times of one thread, or summed over threads
+struct RunStats {
+    uint64_t counters[NUM_COUNTERS] = {};
+    double wall_seconds[NUM_STAGES] = {};
+    double cpu_seconds[NUM_STAGES] = {};
+
+    RunStats& operator+=(const RunStats& other);
+    RunStats& operator-=(const RunStats& other);
+};
+
+#ifndef BLASTN_NO_STATS
+
+// Set once by enableStats(), before any worker starts
+extern bool stats_enabled;
+
+void enableStats();
+
+inline bool statsEnabled() {
+    return stats_enabled;
+}
+
+// Block of the calling thread, created on first use
+RunStats& threadStats();
+
+// All threads' blocks summed; call once the workers have finished
+RunStats totalStats();
+
+inline void addCount(Counter counter, uint64_t n) {
+    if (statsEnabled()) threadStats().counters[static_cast<size_t>(counter)] += n;
+}
+
+// Adds the wall and CPU time from construction to destruction to a stage
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage);
+    ~StageTimer();
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    Stage stage_;
+    bool running_;
+    double wall_start_ = 0;
+    double cpu_start_ = 0;
+};
+
+// JSON object with every counter and stage, elapsed time, CPU time and
+// peak RSS of the process, and the size of the index searched
+void printStatsJson(std::ostream& out, const RunStats& stats, double elapsed_seconds,
+                    size_t index_bytes, int threads);
+
+// One-line JSON object with the counters and stage times of one query
+// (the search stages only)
+void printQueryStatsJson(std::ostream& out, std::string_view query, const RunStats& stats);
+
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+#define STATS_COUNT(counter, n) addCount(counter, n)
+#define STATS_TIMER(stage) StageTimer STATS_CONCAT(stage_timer_, __LINE__)(stage)
+
+#else
+
+#define STATS_COUNT(counter, n) ((void)0)
+#define STATS_TIMER(stage) ((void)0)
+
+#endif // BLASTN_NO_STATS
+
+#endif // STATS_H